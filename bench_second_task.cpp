@@ -0,0 +1,114 @@
+// Benchmarks for the second task: trigram name search, the utilisation index,
+// batch deletion and the text save format. Options are described in
+// benchmark.h; the report is JSON on stdout.
+#define PIPELINE_NO_MAIN
+#include "second_task.cpp"
+#include "benchmark.h"
+
+const char *const benchWords[8] = {"North", "South", "Main", "Branch", "Ring", "Export", "Delta", "Valley"};
+
+void fillPipes(Registry<Pipe> &pipes, size_t count, mt19937_64 &rng) {
+    const int diameters[4] = {500, 700, 1000, 1400};
+    pipes.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        Pipe p((int)i + 1);
+        p.name = string(benchWords[rng() % 8]) + "_line_" + to_string(i + 1);
+        p.length = 1 + rng() % 200;
+        p.diameter = diameters[rng() % 4];
+        p.underRepair = rng() % 10 == 0;
+        pipes.add(move(p));
+    }
+}
+
+void fillStations(Registry<CompressorStation> &stations, size_t count, mt19937_64 &rng) {
+    stations.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        CompressorStation st((int)i + 1);
+        st.name = string(benchWords[rng() % 8]) + "_station_" + to_string(i + 1);
+        st.totalWorkshops = 1 + rng() % 12;
+        st.workingWorkshops = (int)(rng() % (st.totalWorkshops + 1));
+        st.stationClass = 1 + rng() % 5;
+        stations.add(move(st));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opt;
+    if (!parseBenchOptions(argc, argv, opt))
+        return 2;
+    BenchSuite suite(opt);
+    const string dataFile = "bench_data.txt";
+
+    for (size_t n : opt.scales) {
+        mt19937_64 rng(n);
+        Registry<Pipe> pipes;
+        Registry<CompressorStation> stations;
+        fillPipes(pipes, n, rng);
+        fillStations(stations, n, rng);
+        NameIndex pipeNames, stationNames;
+        pipeNames.rebuild(pipes);
+        stationNames.rebuild(stations);
+        UtilisationIndex utilisation;
+        utilisation.rebuild(stations);
+
+        // "Valley" matches about an eighth of the names, "line_42" a handful
+        suite.measure("searchPipesByName", n, (double)n, [&] {
+            searchPipesByName(pipes, pipeNames, "Valley");
+        });
+        suite.measure("searchPipesByName.selective", n, (double)n, [&] {
+            searchPipesByName(pipes, pipeNames, "line_42");
+        });
+
+        suite.measure("searchStationsByUnused", n, (double)n, [&] {
+            searchStationsByUnused(stations, utilisation, 75);
+        });
+
+        // Every run deletes a tenth of the pipes; setup puts them back untimed
+        if (suite.enabled("deletePipesFromVector")) {
+            vector<Pipe> doomed;
+            for (const auto &p : pipes)
+                if (p.id % 10 == 0)
+                    doomed.push_back(p);
+            vector<Handle> handles;
+            suite.measure("deletePipesFromVector", n, (double)doomed.size(),
+                          [&] {
+                              for (const Pipe &p : doomed)
+                                  if (!pipes.contains(p.id)) {
+                                      pipes.add(p);
+                                      pipeNames.add(p.id, p.name);
+                                  }
+                              handles.clear();
+                              for (const Pipe &p : doomed)
+                                  handles.push_back(pipes.handleOf(p.id));
+                          },
+                          [&] { deletePipesFromVector(pipes, pipeNames, handles); });
+        }
+
+        suite.measure("saveToFile", n, (double)(pipes.size() + stations.size()), [&] {
+            if (!writeDataFile(dataFile, pipes, stations))
+                cerr << "saveToFile: cannot write '" << dataFile << "'\n";
+        });
+
+        if (suite.enabled("loadFromFile")) {
+            Registry<Pipe> loadedPipes;
+            Registry<CompressorStation> loadedStations;
+            NameIndex loadedPipeNames, loadedStationNames;
+            UtilisationIndex loadedUtilisation;
+            string error;
+            size_t skipped = 0;
+            if (!writeDataFile(dataFile, pipes, stations))
+                cerr << "loadFromFile: cannot write '" << dataFile << "'\n";
+            suite.measure("loadFromFile", n, (double)(pipes.size() + stations.size()), [&] {
+                if (!loadDataFile(dataFile, loadedPipes, loadedStations, loadedPipeNames, loadedStationNames,
+                                  loadedUtilisation, error, skipped))
+                    cerr << "loadFromFile: " << error << "\n";
+            });
+        }
+        remove(dataFile.c_str());
+    }
+    return suite.finish("second_task");
+}
+
+// g++ -O2 -std=c++17 bench_second_task.cpp -o bench_second_task.exe
+// bench_second_task.exe --max-scale 1000000 --out baseline.json
+// bench_second_task.exe --baseline baseline.json
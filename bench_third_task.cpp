@@ -0,0 +1,126 @@
+// Benchmarks for the third task: incremental edge insertion, topological sort,
+// pipe filtering by diameter and the binary snapshot. Options are described in
+// benchmark.h; the report is JSON on stdout.
+#define PIPELINE_NO_MAIN
+#include "third_task.cpp"
+#include "benchmark.h"
+
+const int benchDiameters[4] = {500, 700, 1000, 1400};
+
+void fillPipes(Registry<Pipe> &pipes, size_t count, mt19937_64 &rng) {
+    pipes.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        Pipe p((int)i + 1);
+        p.name = "Pipe_" + to_string(i + 1);
+        p.length = 1 + rng() % 200;
+        p.diameter = benchDiameters[rng() % 4];
+        p.setRepairStatus(rng() % 10 == 0);
+        pipes.add(p);
+    }
+}
+
+void fillStations(Registry<CompressorStation> &stations, size_t count, mt19937_64 &rng) {
+    stations.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        CompressorStation st((int)i + 1);
+        st.name = "Station_" + to_string(i + 1);
+        st.totalWorkshops = 1 + rng() % 12;
+        st.workingWorkshops = (int)(rng() % (st.totalWorkshops + 1));
+        st.stationClass = 1 + rng() % 5;
+        stations.add(st);
+    }
+}
+
+// Two edges per station, each leading up to 64 stations forward, so the graph
+// stays acyclic while the stations' first appearance order needs occasional reordering
+vector<ConnectionRequest> makeEdges(size_t stationCount, mt19937_64 &rng) {
+    vector<ConnectionRequest> edges;
+    edges.reserve(stationCount * 2);
+    for (size_t from = 1; from < stationCount; from++)
+        for (int k = 0; k < 2; k++) {
+            size_t to = from + 1 + rng() % 64;
+            if (to <= stationCount)
+                edges.push_back({(int)from, (int)to, benchDiameters[rng() % 4]});
+        }
+    return edges;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opt;
+    if (!parseBenchOptions(argc, argv, opt))
+        return 2;
+    BenchSuite suite(opt);
+    const string snapshot = "bench_network.bin";
+
+    for (size_t n : opt.scales) {
+        mt19937_64 rng(n);
+        Registry<Pipe> pipes;
+        Registry<CompressorStation> stations;
+        fillPipes(pipes, n, rng);
+        fillStations(stations, n, rng);
+        vector<ConnectionRequest> edges = makeEdges(n, rng);
+
+        // Insertion is timed per call; large graphs keep every k-th sample only.
+        // Every edge gets its own pipe ID, as in a network the program builds
+        NetworkGraph graph;
+        if (suite.enabled("addEdge")) {
+            size_t stride = max<size_t>(1, edges.size() >> 20);
+            vector<double> samples;
+            samples.reserve(edges.size() / stride + 1);
+            for (size_t i = 0; i < edges.size(); i++) {
+                const ConnectionRequest &e = edges[i];
+                int pipeId = (int)i + 1;
+                if (i % stride) {
+                    graph.addEdge(e.fromId, e.toId, pipeId, e.diameter, 50);
+                    continue;
+                }
+                auto start = chrono::steady_clock::now();
+                graph.addEdge(e.fromId, e.toId, pipeId, e.diameter, 50);
+                samples.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+            }
+            suite.record("addEdge", n, samples, (double)samples.size());
+        } else {
+            for (size_t i = 0; i < edges.size(); i++)
+                graph.addEdge(edges[i].fromId, edges[i].toId, (int)i + 1, edges[i].diameter, 50);
+        }
+
+        suite.measure("topologicalSort", n, (double)graph.stationIds.size(), [&] {
+            vector<int> order = graph.topologicalSort();
+            if (order.size() != graph.stationIds.size())
+                cerr << "topologicalSort: short order\n";
+        });
+
+        PipeAllocator allocator;
+        allocator.rebuild(pipes);
+        suite.measure("searchPipesByDiameter", n, (double)n, [&] {
+            Bitmap hits = allocator.columns().diameterIs(700);
+            hits.andNot(allocator.columns().underRepair());
+            if (hits.count() > n)
+                cerr << "searchPipesByDiameter: bad count\n";
+        });
+
+        suite.measure("saveToFile", n, (double)(pipes.size() + stations.size() + graph.edgeList.size()), [&] {
+            if (!saveSnapshot(snapshot, pipes, stations, graph))
+                cerr << "saveToFile: cannot write '" << snapshot << "'\n";
+        });
+
+        if (suite.enabled("loadFromFile")) {
+            Registry<Pipe> loadedPipes;
+            Registry<CompressorStation> loadedStations;
+            NetworkGraph loadedGraph;
+            string error;
+            if (!saveSnapshot(snapshot, pipes, stations, graph))
+                cerr << "loadFromFile: cannot write '" << snapshot << "'\n";
+            suite.measure("loadFromFile", n, (double)(pipes.size() + stations.size() + graph.edgeList.size()), [&] {
+                if (!loadSnapshot(snapshot, loadedPipes, loadedStations, loadedGraph, error))
+                    cerr << "loadFromFile: " << error << "\n";
+            });
+        }
+        remove(snapshot.c_str());
+    }
+    return suite.finish("third_task");
+}
+
+// g++ -O2 -std=c++17 bench_third_task.cpp -o bench_third_task.exe
+// bench_third_task.exe --max-scale 1000000 --out baseline.json
+// bench_third_task.exe --baseline baseline.json
@@ -0,0 +1,258 @@
+// Benchmark harness shared by bench_second_task.cpp and bench_third_task.cpp.
+// It is included after the program source, whose includes and
+// "using namespace std" it relies on.
+//
+// Options:
+//   --scales 1000,100000   record counts to run, each at most 10^9 (default 10^3, 10^4, 10^5)
+//   --max-scale 10000000   every power of ten from 10^3 up to the given count
+//   --budget 0.5           seconds of timed work per benchmark and scale, above 0
+//   --filter name          run only benchmarks whose name contains the text
+//   --out results.json     write the report to a file instead of stdout
+//   --baseline old.json    compare with an earlier report; exit code 1 on regression
+//   --tolerance 10         slowdown in percent still accepted against the baseline
+#ifndef PIPELINE_BENCHMARK_H
+#define PIPELINE_BENCHMARK_H
+
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+struct BenchResult {
+    string name;
+    size_t scale = 0;
+    size_t iterations = 0;      // timed samples
+    double items = 0;           // records processed by all samples together
+    double seconds = 0;         // total timed work
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;      // ns per sample
+
+    double throughput() const { return seconds > 0 ? items / seconds : 0; }
+};
+
+struct BenchOptions {
+    vector<size_t> scales{1000, 10000, 100000};
+    double budget = 0.5;
+    size_t minIterations = 3;
+    size_t maxIterations = 1000;
+    string filter;
+    string output;
+    string baseline;
+    double tolerance = 10;
+};
+
+const double maxBenchScale = 1e9;
+
+// Record count in 1..maxBenchScale; anything else is reported like a value stod rejects
+size_t parseBenchScale(const string &text) {
+    double scale = stod(text);
+    if (!(scale >= 1 && scale <= maxBenchScale))
+        throw out_of_range("scale");
+    return (size_t)scale;
+}
+
+bool parseBenchOptions(int argc, char *argv[], BenchOptions &opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        string value = argv[++i];
+        try {
+            if (arg == "--scales") {
+                opt.scales.clear();
+                stringstream list(value);
+                string item;
+                while (getline(list, item, ','))
+                    opt.scales.push_back(parseBenchScale(item));
+            } else if (arg == "--max-scale") {
+                size_t limit = parseBenchScale(value);
+                opt.scales.clear();
+                for (size_t n = 1000; n <= limit; n *= 10)
+                    opt.scales.push_back(n);
+            } else if (arg == "--budget") {
+                opt.budget = stod(value);
+                if (!(opt.budget > 0 && isfinite(opt.budget)))
+                    throw out_of_range("budget");
+            } else if (arg == "--filter") {
+                opt.filter = value;
+            } else if (arg == "--out") {
+                opt.output = value;
+            } else if (arg == "--baseline") {
+                opt.baseline = value;
+            } else if (arg == "--tolerance") {
+                opt.tolerance = stod(value);
+                if (!(opt.tolerance >= 0))
+                    throw out_of_range("tolerance");
+            } else {
+                cerr << "Unknown option " << arg << "\n";
+                return false;
+            }
+        } catch (const exception &) {       // not a number or out of range
+            cerr << "Invalid value '" << value << "' for " << arg << "\n";
+            return false;
+        }
+    }
+    if (opt.scales.empty()) {
+        cerr << "No scales to run\n";
+        return false;
+    }
+    return true;
+}
+
+// Value of "key": in one line of a report, empty if absent
+string benchField(const string &line, const string &key) {
+    string pattern = "\"" + key + "\":";
+    size_t start = line.find(pattern);
+    if (start == string::npos)
+        return "";
+    start += pattern.size();
+    if (start < line.size() && line[start] == '"') {
+        size_t close = line.find('"', start + 1);
+        return close == string::npos ? "" : line.substr(start + 1, close - start - 1);
+    }
+    size_t stop = line.find_first_of(",}", start);
+    return line.substr(start, stop == string::npos ? string::npos : stop - start);
+}
+
+class BenchSuite {
+    BenchOptions opt;
+    vector<BenchResult> results;
+
+    static double nanosSince(chrono::steady_clock::time_point start) {
+        return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    }
+
+    static double percentile(const vector<double> &sorted, double p) {
+        size_t rank = (size_t)ceil(p / 100 * sorted.size());
+        return sorted[rank ? rank - 1 : 0];
+    }
+
+public:
+    explicit BenchSuite(const BenchOptions &options) : opt(options) {}
+
+    bool enabled(const string &name) const {
+        return opt.filter.empty() || name.find(opt.filter) != string::npos;
+    }
+
+    // Stores one result built from raw samples (ns each); items is the record
+    // count the samples processed together
+    void record(const string &name, size_t scale, vector<double> &samples, double items) {
+        if (samples.empty())
+            return;
+        BenchResult r;
+        r.name = name;
+        r.scale = scale;
+        r.iterations = samples.size();
+        r.items = items;
+        for (double s : samples)
+            r.seconds += s / 1e9;
+        sort(samples.begin(), samples.end());
+        r.p50 = percentile(samples, 50);
+        r.p90 = percentile(samples, 90);
+        r.p99 = percentile(samples, 99);
+        r.max = samples.back();
+        results.push_back(r);
+        cerr << name << " @" << scale << ": " << r.iterations << " run(s), p50 " << r.p50 / 1e3 << " us, "
+             << (size_t)r.throughput() << " items/s\n";
+    }
+
+    // Runs setup() untimed and run() timed, repeatedly, until the time budget
+    // is used up (at least minIterations, at most maxIterations runs);
+    // every run processes itemsPerRun records
+    template <class Setup, class Run>
+    void measure(const string &name, size_t scale, double itemsPerRun, Setup setup, Run run) {
+        if (!enabled(name))
+            return;
+        vector<double> samples;
+        double spent = 0;
+        while (samples.size() < opt.maxIterations && (samples.size() < opt.minIterations || spent < opt.budget * 1e9)) {
+            setup();
+            auto start = chrono::steady_clock::now();
+            run();
+            samples.push_back(nanosSince(start));
+            spent += samples.back();
+        }
+        record(name, scale, samples, itemsPerRun * samples.size());
+    }
+
+    template <class Run>
+    void measure(const string &name, size_t scale, double itemsPerRun, Run run) {
+        measure(name, scale, itemsPerRun, [] {}, run);
+    }
+
+    // Writes the report and compares it with the baseline; returns the exit code
+    int finish(const string &program) {
+        map<pair<string, size_t>, pair<double, double>> base;       // -> p50, throughput
+        if (!opt.baseline.empty()) {
+            ifstream in(opt.baseline);
+            if (!in.is_open()) {
+                cerr << "Cannot open baseline '" << opt.baseline << "'\n";
+                return 2;
+            }
+            string line;
+            for (size_t lineNo = 1; getline(in, line); lineNo++) {
+                string name = benchField(line, "name");
+                if (name.empty())
+                    continue;
+                try {
+                    base[{name, (size_t)stoull(benchField(line, "scale"))}] = {stod(benchField(line, "p50_ns")),
+                                                                              stod(benchField(line, "throughput"))};
+                } catch (const exception &) {
+                    cerr << "Malformed result on line " << lineNo << " of baseline '" << opt.baseline << "'\n";
+                    return 2;
+                }
+            }
+        }
+
+        long peakRssKb = 0;
+#ifndef _WIN32
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            peakRssKb = usage.ru_maxrss;
+#endif
+
+        ostringstream json;
+        json << fixed << setprecision(1);
+        json << "{\"program\":\"" << program << "\",\"threads\":" << thread::hardware_concurrency()
+             << ",\"peakRssKb\":" << peakRssKb << ",\"results\":[\n";
+        size_t regressions = 0;
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult &r = results[i];
+            json << "{\"name\":\"" << r.name << "\",\"scale\":" << r.scale << ",\"iterations\":" << r.iterations
+                 << ",\"throughput\":" << r.throughput() << ",\"p50_ns\":" << r.p50 << ",\"p90_ns\":" << r.p90
+                 << ",\"p99_ns\":" << r.p99 << ",\"max_ns\":" << r.max;
+            auto b = base.find({r.name, r.scale});
+            if (b != base.end()) {
+                double p50Change = (r.p50 / b->second.first - 1) * 100;
+                double throughputChange = (r.throughput() / b->second.second - 1) * 100;
+                bool regressed = p50Change > opt.tolerance || -throughputChange > opt.tolerance;
+                regressions += regressed;
+                json << ",\"baseline_p50_ns\":" << b->second.first << ",\"p50_change_pct\":" << p50Change
+                     << ",\"baseline_throughput\":" << b->second.second << ",\"throughput_change_pct\":"
+                     << throughputChange << ",\"regressed\":" << (regressed ? "true" : "false");
+            }
+            json << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        json << "],\"regressions\":" << regressions << "}\n";
+
+        if (opt.output.empty()) {
+            cout << json.str();
+        } else {
+            ofstream out(opt.output);
+            if (!(out << json.str())) {
+                cerr << "Cannot write '" << opt.output << "'\n";
+                return 2;
+            }
+        }
+        if (regressions)
+            cerr << regressions << " regression(s) beyond " << opt.tolerance << "% against '" << opt.baseline << "'\n";
+        return regressions ? 1 : 0;
+    }
+};
+
+#endif
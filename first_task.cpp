@@ -2,6 +2,13 @@
 #include <fstream>
 #include <string>
 #include <limits>
+#include <sstream>
+#include <vector>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <system_error>
 
 using namespace std;
 
@@ -152,23 +159,58 @@ void stopWorkshop(CompressorStation &station)
     }
 }
 
-void saveToFile(const Pipe &pipe, const CompressorStation &station, const string &filename)
+bool writeData(const Pipe &pipe, const CompressorStation &station, const string &filename)
 {
     ofstream file(filename);
-    if (file.is_open())
-    {
-        file << "PIPE\n";
-        file << pipe.name << "\n";
-        file << pipe.length << "\n";
-        file << pipe.diameter << "\n";
-        file << pipe.underRepair << "\n";
-
-        file << "STATION\n";
-        file << station.name << "\n";
-        file << station.totalWorkshops << "\n";
-        file << station.workingWorkshops << "\n";
-        file << station.stationClass << "\n";
+    if (!file.is_open())
+        return false;
+    file << "PIPE\n";
+    file << pipe.name << "\n";
+    file << pipe.length << "\n";
+    file << pipe.diameter << "\n";
+    file << pipe.underRepair << "\n";
+
+    file << "STATION\n";
+    file << station.name << "\n";
+    file << station.totalWorkshops << "\n";
+    file << station.workingWorkshops << "\n";
+    file << station.stationClass << "\n";
+    return bool(file);
+}
+
+bool readData(Pipe &pipe, CompressorStation &station, const string &filename)
+{
+    ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    string pipeHeader, stationHeader;
+    Pipe newPipe;
+    CompressorStation newStation;
+
+    getline(file, pipeHeader);
+    getline(file, newPipe.name);
+    file >> newPipe.length;
+    file >> newPipe.diameter;
+    file >> newPipe.underRepair;
+    file.ignore();
+
+    getline(file, stationHeader);
+    getline(file, newStation.name);
+    file >> newStation.totalWorkshops;
+    file >> newStation.workingWorkshops;
+    file >> newStation.stationClass;
+    // the current data is replaced only by a file that was read completely
+    if (!file || pipeHeader != "PIPE" || stationHeader != "STATION")
+        return false;
+    pipe = newPipe;
+    station = newStation;
+    return true;
+}
 
+void saveToFile(const Pipe &pipe, const CompressorStation &station, const string &filename)
+{
+    if (writeData(pipe, station, filename))
+    {
         cout << "Data saved to " << filename << " successfully!\n";
     }
     else
@@ -179,24 +221,8 @@ void saveToFile(const Pipe &pipe, const CompressorStation &station, const string
 
 void loadFromFile(Pipe &pipe, CompressorStation &station, const string &filename)
 {
-    ifstream file(filename);
-    if (file.is_open())
+    if (readData(pipe, station, filename))
     {
-        string line;
-
-        getline(file, line);
-        getline(file, pipe.name);
-        file >> pipe.length;
-        file >> pipe.diameter;
-        file >> pipe.underRepair;
-        file.ignore();
-
-        getline(file, line);
-        getline(file, station.name);
-        file >> station.totalWorkshops;
-        file >> station.workingWorkshops;
-        file >> station.stationClass;
-
         cout << "Data loaded from " << filename << " successfully!\n";
     }
     else
@@ -205,6 +231,201 @@ void loadFromFile(Pipe &pipe, CompressorStation &station, const string &filename
     }
 }
 
+// Headless mode: one command per line, names with spaces in double quotes,
+// one JSON line per command. Output is collected and written in large blocks.
+bool splitCommand(const string &line, vector<string> &args)
+{
+    args.clear();
+    size_t i = 0;
+    while (i < line.size())
+    {
+        if (isspace((unsigned char)line[i]))
+        {
+            i++;
+            continue;
+        }
+        if (line[i] == '#')
+            break;
+        string arg;
+        if (line[i] == '"')
+        {
+            size_t close = line.find('"', i + 1);
+            if (close == string::npos)
+                return false;
+            arg = line.substr(i + 1, close - i - 1);
+            i = close + 1;
+        }
+        else
+        {
+            while (i < line.size() && !isspace((unsigned char)line[i]))
+                arg += line[i++];
+        }
+        args.push_back(arg);
+    }
+    return true;
+}
+
+string jsonString(const string &text)
+{
+    string result = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        }
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+// reads a whole argument as a number, the same way as the other two programs' batch modes
+template <class T>
+bool parseArg(const string &arg, T &value)
+{
+    const char *end = arg.data() + arg.size();
+    auto result = from_chars(arg.data(), end, value);
+    return result.ec == errc() && result.ptr == end;
+}
+
+void writePipe(ostringstream &out, const Pipe &pipe)
+{
+    out << "{\"name\":" << jsonString(pipe.name) << ",\"length\":" << pipe.length << ",\"diameter\":" << pipe.diameter
+        << ",\"repair\":" << (pipe.underRepair ? "true" : "false") << "}";
+}
+
+void writeStation(ostringstream &out, const CompressorStation &station)
+{
+    out << "{\"name\":" << jsonString(station.name) << ",\"total\":" << station.totalWorkshops
+        << ",\"working\":" << station.workingWorkshops << ",\"class\":" << station.stationClass << "}";
+}
+
+// Runs a command script; returns the number of commands that failed
+int runBatch(istream &script, Pipe &pipe, CompressorStation &station, const string &filename)
+{
+    ostringstream out;
+    string line;
+    vector<string> args;
+    int lineNo = 0, failed = 0;
+
+    while (getline(script, line))
+    {
+        lineNo++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!splitCommand(line, args))
+        {
+            out << "{\"line\":" << lineNo << ",\"cmd\":\"\",\"ok\":false,\"error\":\"unterminated quote\"}\n";
+            failed++;
+            continue;
+        }
+        if (args.empty())
+            continue;
+        string cmd = args[0];
+        string what = args.size() > 1 ? args[1] : "";
+        string result, error;
+
+        if (cmd == "add" && what == "pipe" && args.size() == 5)
+        {
+            Pipe added;
+            added.name = args[2];
+            added.underRepair = false;
+            if (!parseArg(args[3], added.length) || added.length <= 0 || !parseArg(args[4], added.diameter) || added.diameter <= 0)
+                error = "expected: add pipe NAME LENGTH DIAMETER";
+            else
+                pipe = added;
+        }
+        else if (cmd == "add" && what == "station" && args.size() == 6)
+        {
+            CompressorStation added;
+            added.name = args[2];
+            if (!parseArg(args[3], added.totalWorkshops) || added.totalWorkshops <= 0 ||
+                !parseArg(args[4], added.workingWorkshops) || added.workingWorkshops < 0 ||
+                added.workingWorkshops > added.totalWorkshops || !parseArg(args[5], added.stationClass) || added.stationClass <= 0)
+                error = "expected: add station NAME TOTAL WORKING CLASS";
+            else
+                station = added;
+        }
+        else if (cmd == "add")
+            error = "expected: add pipe|station ...";
+        else if (cmd == "show" && args.size() == 1)
+        {
+            ostringstream objects;
+            objects << ",\"pipe\":";
+            if (pipe.name.empty())
+                objects << "null";
+            else
+                writePipe(objects, pipe);
+            objects << ",\"station\":";
+            if (station.name.empty())
+                objects << "null";
+            else
+                writeStation(objects, station);
+            result = objects.str();
+        }
+        else if (cmd == "repair" && args.size() == 1)
+        {
+            if (pipe.name.empty())
+                error = "no pipe to edit";
+            else
+            {
+                pipe.underRepair = !pipe.underRepair;
+                result = string(",\"repair\":") + (pipe.underRepair ? "true" : "false");
+            }
+        }
+        else if ((cmd == "start" || cmd == "stop") && args.size() == 1)
+        {
+            if (station.name.empty())
+                error = "no station to edit";
+            else if (cmd == "start" && station.workingWorkshops >= station.totalWorkshops)
+                error = "all workshops are already working";
+            else if (cmd == "stop" && station.workingWorkshops <= 0)
+                error = "no working workshops to stop";
+            else
+            {
+                station.workingWorkshops += cmd == "start" ? 1 : -1;
+                result = ",\"working\":" + to_string(station.workingWorkshops);
+            }
+        }
+        else if ((cmd == "save" || cmd == "load") && args.size() <= 2)
+        {
+            string file = args.size() == 2 ? args[1] : filename;
+            if (cmd == "save" ? !writeData(pipe, station, file) : !readData(pipe, station, file))
+                error = cmd == "save" ? "error saving file" : "error loading file";
+            else
+                result = ",\"file\":" + jsonString(file);
+        }
+        else
+            error = "unknown command";
+
+        out << "{\"line\":" << lineNo << ",\"cmd\":" << jsonString(cmd);
+        if (error.empty())
+            out << ",\"ok\":true" << result << "}\n";
+        else
+        {
+            out << ",\"ok\":false,\"error\":" << jsonString(error) << "}\n";
+            failed++;
+        }
+        if (out.tellp() >= 65536)
+        {
+            cout << out.str();
+            out.str("");
+        }
+    }
+
+    cout << out.str();
+    cout.flush();
+    return failed;
+}
+
 void displayMenu()
 {
     cout << "\n=== Pipeline Management System ===\n";
@@ -228,7 +449,7 @@ void displayStationMenu()
     cout << "Choose an option: ";
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     Pipe pipe;
     CompressorStation station;
@@ -238,6 +459,22 @@ int main()
     pipe.name = "";
     station.name = "";
 
+    // --batch FILE runs a command script, --batch alone reads commands from stdin
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+    {
+        if (argc > 2 && strcmp(argv[2], "-") != 0)
+        {
+            ifstream script(argv[2]);
+            if (!script.is_open())
+            {
+                cerr << "Error: cannot open script " << argv[2] << "\n";
+                return 2;
+            }
+            return runBatch(script, pipe, station, filename) ? 1 : 0;
+        }
+        return runBatch(cin, pipe, station, filename) ? 1 : 0;
+    }
+
     do
     {
         displayMenu();
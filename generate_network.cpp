@@ -0,0 +1,331 @@
+// Deterministic synthetic gas network for load testing. The same options and
+// seed always produce a byte-identical file. Output is streamed: nothing is
+// kept in memory beyond the write buffer, so networks with millions of
+// stations cost only disk space.
+//
+// Options:
+//   --stations N           number of compressor stations (default 1000)
+//   --topology KIND        dag, layered or cyclic (default dag)
+//   --degree D             average pipes leaving a station, 0..1000 (default 2)
+//   --window W             dag/cyclic: how many stations ahead a pipe may lead (default 64)
+//   --layers L             layered: number of layers, pipes only join neighbouring layers (default 16)
+//   --cycles F             cyclic: share of stations with a pipe leading back, 0..1 (default 0.05)
+//   --diameters MIX        weights per diameter, 500/700/1000/1400 only (default 500:40,700:30,1000:20,1400:10)
+//   --repair F             share of pipes under repair, 0..1 (default 0.05)
+//   --spare F              unconnected pipes, as a share of the connected ones, >= 0 (default 0.1)
+//   --workshops N          workshops per station, 1..N (default 12)
+//   --classes N            station classes, 1..N (default 5)
+//   --seed S               (default 1)
+//   --format FORMAT        snapshot (third task) or text (second task); default snapshot
+//   --out FILE             default pipeline_network.bin / pipeline_data.txt
+// The text format has no network section, so it receives the same pipes and
+// stations without the connections.
+#define PIPELINE_NO_MAIN
+#include "third_task.cpp"
+
+struct GeneratorOptions {
+    uint64_t stations = 1000;
+    string topology = "dag";
+    int degree = 2;
+    int window = 64;
+    int layers = 16;
+    double cycles = 0.05;
+    vector<pair<int, double>> diameters{{500, 40}, {700, 30}, {1000, 20}, {1400, 10}};
+    double repair = 0.05;
+    double spare = 0.1;
+    int workshops = 12;
+    int classes = 5;
+    uint64_t seed = 1;
+    string format = "snapshot";
+    string output;
+};
+
+const int maxGeneratorDegree = 1000;
+const int maxGeneratorSpan = 1000000000;      // --window, --layers
+
+bool standardDiameter(int diameter) {
+    return diameter == 500 || diameter == 700 || diameter == 1000 || diameter == 1400;
+}
+
+bool parseGeneratorOptions(int argc, char *argv[], GeneratorOptions &opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << arg << "\n";
+            return false;
+        }
+        string value = argv[++i];
+        try {
+            if (arg == "--stations") {
+                double count = stod(value);
+                opt.stations = count >= 1 && count < numeric_limits<int>::max() ? (uint64_t)count : 0;
+            } else if (arg == "--topology") {
+                opt.topology = value;
+            } else if (arg == "--degree") {
+                opt.degree = stoi(value);
+            } else if (arg == "--window") {
+                opt.window = stoi(value);
+            } else if (arg == "--layers") {
+                opt.layers = stoi(value);
+            } else if (arg == "--cycles") {
+                opt.cycles = stod(value);
+            } else if (arg == "--diameters") {
+                opt.diameters.clear();
+                stringstream list(value);
+                string item;
+                while (getline(list, item, ',')) {
+                    size_t colon = item.find(':');
+                    if (colon == string::npos) {
+                        cerr << "Expected DIAMETER:WEIGHT in '" << item << "'\n";
+                        return false;
+                    }
+                    opt.diameters.push_back({stoi(item.substr(0, colon)), stod(item.substr(colon + 1))});
+                }
+            } else if (arg == "--repair") {
+                opt.repair = stod(value);
+            } else if (arg == "--spare") {
+                opt.spare = stod(value);
+            } else if (arg == "--workshops") {
+                opt.workshops = stoi(value);
+            } else if (arg == "--classes") {
+                opt.classes = stoi(value);
+            } else if (arg == "--seed") {
+                opt.seed = stoull(value);
+            } else if (arg == "--format") {
+                opt.format = value;
+            } else if (arg == "--out") {
+                opt.output = value;
+            } else {
+                cerr << "Unknown option " << arg << "\n";
+                return false;
+            }
+        } catch (const exception &) {       // stoi/stod/stoull: not a number or out of range
+            cerr << "Invalid value '" << value << "' for " << arg << "\n";
+            return false;
+        }
+    }
+    if (opt.topology != "dag" && opt.topology != "layered" && opt.topology != "cyclic") {
+        cerr << "Unknown topology '" << opt.topology << "'\n";
+        return false;
+    }
+    if (opt.format != "snapshot" && opt.format != "text") {
+        cerr << "Unknown format '" << opt.format << "'\n";
+        return false;
+    }
+    if (opt.stations == 0 || opt.stations >= (uint64_t)numeric_limits<int>::max() || opt.degree < 0 ||
+        opt.degree > maxGeneratorDegree || opt.window < 1 || opt.window > maxGeneratorSpan || opt.layers < 1 ||
+        opt.layers > maxGeneratorSpan || !(opt.cycles >= 0 && opt.cycles <= 1) || !(opt.repair >= 0 && opt.repair <= 1) ||
+        !(opt.spare >= 0 && isfinite(opt.spare)) || opt.workshops < 1 || opt.classes < 1) {
+        cerr << "Option out of range\n";
+        return false;
+    }
+    double weights = 0;
+    for (auto &d : opt.diameters) {
+        if (!standardDiameter(d.first) || !(d.second >= 0 && isfinite(d.second))) {
+            cerr << "Bad diameter mix: diameters are 500, 700, 1000 or 1400 with non-negative weights\n";
+            return false;
+        }
+        weights += d.second;
+    }
+    if (!(weights > 0 && isfinite(weights))) {
+        cerr << "Bad diameter mix: the weights add up to nothing\n";
+        return false;
+    }
+    if (opt.output.empty())
+        opt.output = opt.format == "text" ? "pipeline_data.txt" : "pipeline_network.bin";
+    return true;
+}
+
+// Every field of every record is an independent hash of (seed, field, index),
+// so each column of the snapshot is regenerated in its own pass instead of
+// being held in memory. Station v has ID v + 1 and dense graph index v; edge e
+// in CSR order (grouped by source station) runs through pipe e + 1, and pipes
+// after the last edge are spares.
+class NetworkGenerator {
+    enum Stream { S_DEGREE, S_TARGET, S_BACK, S_DIAMETER, S_LENGTH, S_REPAIR, S_TOTAL, S_WORKING, S_CLASS };
+
+    GeneratorOptions opt;
+    vector<double> cumulative;      // diameter weights, running sum
+    uint64_t layerSize = 1;
+
+    uint64_t random(Stream stream, uint64_t index, uint64_t salt = 0) const {
+        uint64_t z = opt.seed * 0x9E3779B97F4A7C15ull + ((uint64_t)stream << 56) + index * 0xBF58476D1CE4E5B9ull + salt;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    double uniform(Stream stream, uint64_t index, uint64_t salt = 0) const {
+        return (random(stream, index, salt) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+public:
+    uint64_t edgeCount = 0;
+    uint64_t pipeCount = 0;
+
+    explicit NetworkGenerator(const GeneratorOptions &options) : opt(options) {
+        double sum = 0;
+        for (auto &d : opt.diameters)
+            cumulative.push_back(sum += d.second);
+        layerSize = (opt.stations + opt.layers - 1) / opt.layers;
+        vector<int> out;
+        for (uint64_t v = 0; v < opt.stations; v++) {
+            targets(v, out);
+            edgeCount += out.size();
+        }
+        // clamped so that an oversized share ends at the "too many pipes" check, not in a wrapped count
+        pipeCount = edgeCount + (uint64_t)min(edgeCount * opt.spare, (double)numeric_limits<int>::max());
+    }
+
+    bool acyclic() const { return opt.topology != "cyclic"; }
+    uint64_t stationCount() const { return opt.stations; }
+
+    // Dense indices of the stations that pipes leaving station v lead to
+    void targets(uint64_t v, vector<int> &out) const {
+        out.clear();
+        int degree = (int)(random(S_DEGREE, v) % (2 * (uint64_t)opt.degree + 1));
+        uint64_t first = v + 1, span = opt.window;
+        if (opt.topology == "layered") {
+            first = (v / layerSize + 1) * layerSize;
+            span = layerSize;
+        }
+        for (int k = 0; k < degree; k++) {
+            uint64_t to = first + random(S_TARGET, v, k) % span;
+            if (to < opt.stations)
+                out.push_back((int)to);
+        }
+        if (opt.topology == "cyclic" && v > 0 && uniform(S_BACK, v) < opt.cycles)
+            out.push_back((int)(v - 1 - random(S_BACK, v, 1) % min<uint64_t>(v, opt.window)));
+    }
+
+    int diameter(uint64_t pipe) const {
+        double pick = uniform(S_DIAMETER, pipe) * cumulative.back();
+        size_t i = upper_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+        return opt.diameters[min(i, opt.diameters.size() - 1)].first;
+    }
+    double length(uint64_t pipe) const { return 5 + (double)(random(S_LENGTH, pipe) % 1950) / 10; }
+    bool underRepair(uint64_t pipe) const { return uniform(S_REPAIR, pipe) < opt.repair; }
+    bool inUse(uint64_t pipe) const { return pipe <= edgeCount; }
+
+    int totalWorkshops(uint64_t v) const { return 1 + (int)(random(S_TOTAL, v) % opt.workshops); }
+    int workingWorkshops(uint64_t v) const { return (int)(random(S_WORKING, v) % ((uint64_t)totalWorkshops(v) + 1)); }
+    int stationClass(uint64_t v) const { return 1 + (int)(random(S_CLASS, v) % opt.classes); }
+};
+
+// Mirrors saveSnapshot section by section, with every value computed on the fly
+// instead of read from a registry; a change to the layout has to touch both
+bool writeGeneratedSnapshot(const NetworkGenerator &gen, const string &filename) {
+    SafeFileWriter out(filename);
+    if (!out.ok())
+        return false;
+    writeSnapshotHeader(out, gen.acyclic());
+
+    uint64_t np = gen.pipeCount, ns = gen.stationCount(), m = gen.edgeCount;
+    streamArray<int>(out, np, [](uint64_t i) { return (int)i + 1; });
+    streamArray<double>(out, np, [&](uint64_t i) { return gen.length(i + 1); });
+    streamArray<int>(out, np, [&](uint64_t i) { return gen.diameter(i + 1); });
+    streamArray<uint8_t>(out, np, [&](uint64_t i) {
+        return (uint8_t)((gen.underRepair(i + 1) ? 1 : 0) | (gen.inUse(i + 1) ? 2 : 0));
+    });
+    writeNames(out, np, [](uint64_t i) { return "Pipe_" + to_string(i + 1); });
+
+    streamArray<int>(out, ns, [](uint64_t v) { return (int)v + 1; });
+    streamArray<int>(out, ns, [&](uint64_t v) { return gen.totalWorkshops(v); });
+    streamArray<int>(out, ns, [&](uint64_t v) { return gen.workingWorkshops(v); });
+    streamArray<int>(out, ns, [&](uint64_t v) { return gen.stationClass(v); });
+    writeNames(out, ns, [](uint64_t v) { return "Station_" + to_string(v + 1); });
+
+    // Graph: every station is part of it, in ID order; forward edges make the
+    // identity a valid topological order (ignored when the network is cyclic)
+    vector<int> targets;
+    streamArray<int>(out, ns, [](uint64_t v) { return (int)v + 1; });
+    streamArray<int>(out, ns, [](uint64_t v) { return (int)v; });
+    uint64_t offset = 0;
+    streamArray<int>(out, ns + 1, [&](uint64_t v) {
+        uint64_t start = offset;
+        if (v < ns) {
+            gen.targets(v, targets);
+            offset += targets.size();
+        }
+        return (int)start;
+    });
+    uint64_t source = 0;
+    size_t next = 0;
+    targets.clear();
+    streamArray<int>(out, m, [&](uint64_t) {
+        while (next == targets.size()) {
+            gen.targets(source++, targets);
+            next = 0;
+        }
+        return targets[next++];
+    });
+    streamArray<int>(out, m, [](uint64_t e) { return (int)e + 1; });
+    streamArray<int>(out, m, [&](uint64_t e) { return gen.diameter(e + 1); });
+    streamArray<double>(out, m, [&](uint64_t e) { return gen.length(e + 1); });
+    streamArray<uint8_t>(out, m, [&](uint64_t e) { return (uint8_t)(gen.underRepair(e + 1) ? 1 : 0); });
+    return out.commit();
+}
+
+// Second task text format: "PIPES n", id|name|length|diameter|repair, "STATIONS n", id|name|total|working|class
+bool writeGeneratedText(const NetworkGenerator &gen, const string &filename) {
+    SafeFileWriter out(filename);
+    if (!out.ok())
+        return false;
+    char digits[32];
+    auto text = [&](const string &s) { out.write(s.data(), s.size()); };
+    auto number = [&](auto value) {
+        auto r = to_chars(digits, digits + sizeof(digits), value);
+        out.write(digits, r.ptr - digits);
+    };
+    text("PIPES ");
+    number(gen.pipeCount);
+    text("\n");
+    for (uint64_t p = 1; p <= gen.pipeCount; p++) {
+        number(p);
+        text("|Pipe_");
+        number(p);
+        text("|");
+        number(gen.length(p));
+        text("|");
+        number(gen.diameter(p));
+        text(gen.underRepair(p) ? "|1\n" : "|0\n");
+    }
+    text("STATIONS ");
+    number(gen.stationCount());
+    text("\n");
+    for (uint64_t v = 0; v < gen.stationCount(); v++) {
+        number(v + 1);
+        text("|Station_");
+        number(v + 1);
+        text("|");
+        number(gen.totalWorkshops(v));
+        text("|");
+        number(gen.workingWorkshops(v));
+        text("|");
+        number(gen.stationClass(v));
+        text("\n");
+    }
+    return out.commit();
+}
+
+int main(int argc, char *argv[]) {
+    GeneratorOptions opt;
+    if (!parseGeneratorOptions(argc, argv, opt))
+        return 2;
+    NetworkGenerator gen(opt);
+    if (gen.pipeCount >= (uint64_t)numeric_limits<int>::max()) {
+        cerr << "Too many pipes (" << gen.pipeCount << "); lower --stations, --degree or --spare\n";
+        return 2;
+    }
+    bool ok = opt.format == "text" ? writeGeneratedText(gen, opt.output) : writeGeneratedSnapshot(gen, opt.output);
+    if (!ok) {
+        cerr << "Cannot write '" << opt.output << "'\n";
+        return 1;
+    }
+    cout << "Generated '" << opt.output << "': " << gen.stationCount() << " stations, " << gen.pipeCount << " pipes, "
+         << gen.edgeCount << " connections (" << opt.topology << ", seed " << opt.seed << ")\n";
+    return 0;
+}
+
+// g++ -O2 -std=c++17 generate_network.cpp -o generate_network.exe
+// generate_network.exe --stations 1000000 --topology layered --layers 50 --seed 7
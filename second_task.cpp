@@ -6,441 +6,2854 @@
 #include <ctime>
 #include <sstream>
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <memory>
+#include <new>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <string_view>
+#include <filesystem>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// когда фоновый поток записывает журнал в файл
+struct LogPolicy
+{
+    size_t capacity = 4096;    // ячейки кольца, округляется до степени двойки
+    int flushIntervalMs = 200; // максимальное ожидание записи; 0 - будить поток на каждую запись
+    size_t flushBatch = 256;   // будить поток раньше, если накопилось столько записей
+};
+
 // логгер для правильного открытия и закрытия файла
+// вызывающие формируют строку и кладут ее в lock-free кольцо, фоновый поток забирает записи пачками:
+// одна запись в файл и один flush на пачку; деструктор дописывает все, что осталось в очереди
 class Logger
 {
+    struct Cell
+    {
+        atomic<size_t> seq;
+        string line;
+    };
     ofstream logFile;
+    LogPolicy policy;
+    unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0; // только поток записи
+    atomic<size_t> written{0};
+    mutex m;
+    condition_variable wake, drained;
+    bool wakeRequested = false;
+    bool stopping = false;
+    thread writer;
 
-    string getCurrentTime()
+    // время с точностью до секунды, форматируется заново только при смене секунды
+    static const char *currentTime()
     {
+        thread_local time_t cachedSecond = -1;
+        thread_local char buffer[20];
         time_t now = time(nullptr);
-        tm *timeinfo = localtime(&now);
-        char buffer[20];
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-        return string(buffer);
+        if (now != cachedSecond)
+        {
+            cachedSecond = now;
+            tm timeinfo;
+#ifdef _WIN32
+            localtime_s(&timeinfo, &now);
+#else
+            localtime_r(&now, &timeinfo);
+#endif
+            strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+        }
+        return buffer;
+    }
+
+    bool push(string &line)
+    {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = cells[pos & mask];
+            intptr_t diff = (intptr_t)cell.seq.load(memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                {
+                    cell.line.swap(line);
+                    cell.seq.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(string &out)
+    {
+        Cell &cell = cells[dequeuePos & mask];
+        if (cell.seq.load(memory_order_acquire) != dequeuePos + 1)
+            return false;
+        out.swap(cell.line);
+        cell.line.clear();
+        cell.seq.store(dequeuePos + mask + 1, memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+
+    void requestWake()
+    {
+        lock_guard<mutex> lock(m);
+        wakeRequested = true;
+        wake.notify_one();
+    }
+
+    void run()
+    {
+        string batch, line;
+        unique_lock<mutex> lock(m);
+        for (;;)
+        {
+            wake.wait_for(lock, chrono::milliseconds(policy.flushIntervalMs > 0 ? policy.flushIntervalMs : 1000),
+                          [&] { return wakeRequested || stopping; });
+            wakeRequested = false;
+            bool last = stopping;
+            lock.unlock();
+
+            size_t count = 0;
+            while (pop(line))
+            {
+                batch += line;
+                count++;
+            }
+            if (count)
+            {
+                logFile.write(batch.data(), batch.size());
+                logFile.flush();
+                batch.clear();
+                written.fetch_add(count, memory_order_release);
+            }
+
+            lock.lock();
+            drained.notify_all();
+            // записи, чьи ячейки заняты до остановки, вот-вот будут дописаны
+            if (last && written.load(memory_order_acquire) == enqueuePos.load(memory_order_acquire))
+                return;
+        }
     }
 
 public:
-    Logger(const string &filename = "pipeline_log.txt")
+    Logger(const string &filename = "pipeline_log.txt", const LogPolicy &logPolicy = LogPolicy()) : policy(logPolicy)
     {
         logFile.open(filename, ios::app);
+        if (!logFile.is_open())
+            return;
+        size_t capacity = 2;
+        while (capacity < policy.capacity)
+            capacity <<= 1;
+        cells.reset(new Cell[capacity]);
+        for (size_t i = 0; i < capacity; i++)
+            cells[i].seq.store(i, memory_order_relaxed);
+        mask = capacity - 1;
+        writer = thread(&Logger::run, this);
     }
     ~Logger()
     {
+        if (writer.joinable())
+        {
+            {
+                lock_guard<mutex> lock(m);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+        }
         if (logFile.is_open())
             logFile.close();
     }
 
     void log(const string &action)
     {
-        if (logFile.is_open())
+        if (!writer.joinable())
+            return;
+        string line;
+        line.reserve(action.size() + 24);
+        line += '[';
+        line += currentTime();
+        line += "] ";
+        line += action;
+        line += '\n';
+        while (!push(line)) // кольцо заполнено: ждем поток записи, записи не теряются
         {
-            logFile << "[" << getCurrentTime() << "] " << action << "\n";
-            logFile.flush();
+            requestWake();
+            this_thread::yield();
         }
+        size_t pending = enqueuePos.load(memory_order_relaxed) - written.load(memory_order_relaxed);
+        if (policy.flushIntervalMs == 0 || pending >= policy.flushBatch)
+            requestWake();
+    }
+
+    // ждет, пока все записи, сделанные до вызова, окажутся в файле
+    void flush()
+    {
+        if (!writer.joinable())
+            return;
+        size_t target = enqueuePos.load(memory_order_acquire);
+        unique_lock<mutex> lock(m);
+        wakeRequested = true;
+        wake.notify_one();
+        drained.wait(lock, [&] { return written.load(memory_order_acquire) >= target; });
     }
 };
 
 Logger g_logger; // глобальная переменная чтобы вызывать
 
-// структуры
-struct Pipe
+// метрики операций: гистограмма задержек и три счетчика на каждую операцию
+// счетчики общие для процесса; ScopedTimer относит к своей операции их прирост за время
+// своей жизни, поэтому вложенная операция (загрузка со сворачиванием журнала) учитывается в обеих
+enum MetricOp
 {
-    static int nextId;
-    int id;
-    string name;
-    double length;
-    int diameter;
-    bool underRepair;
+    OP_ADD, OP_SEARCH, OP_EDIT, OP_SAVE, OP_LOAD, OP_RECOVER, OP_COUNT
+};
+const char *const metricOpNames[OP_COUNT] = {"add", "search", "edit", "save", "load", "recover"};
 
-    Pipe() : id(++nextId), length(0), diameter(0), underRepair(false) {}
-    // функции валидации ввода
-    double getLength() const { return length; }
-    int getDiameter() const { return diameter; }
-    bool isUnderRepair() const { return underRepair; }
-    void setRepairStatus(bool status) { underRepair = status; }
+enum MetricCounter
+{
+    MC_SCANNED, MC_ALLOCATIONS, MC_BYTES_WRITTEN, MC_COUNT
 };
+const char *const metricCounterNames[MC_COUNT] = {"records_scanned", "allocations", "bytes_written"};
 
-int Pipe::nextId = 0;
+atomic<uint64_t> g_counters[MC_COUNT];
 
-struct CompressorStation
+inline void countMetric(MetricCounter counter, uint64_t n)
 {
-    static int nextId;
-    int id;
-    string name;
-    int totalWorkshops;
-    int workingWorkshops;
-    int stationClass;
+    g_counters[counter].fetch_add(n, memory_order_relaxed);
+}
 
-    CompressorStation() : id(++nextId), totalWorkshops(0), workingWorkshops(0), stationClass(0) {}
+// глобальные функции выделения памяти заменены только ради счетчика выделений;
+// формы для массивов и nothrow по умолчанию вызывают их же
+// не встраиваются, чтобы компилятор не сопоставлял встроенный free() с выражением new
+#if defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE
+#endif
+NOINLINE void *operator new(size_t size)
+{
+    g_counters[MC_ALLOCATIONS].fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+NOINLINE void operator delete(void *p) noexcept { free(p); }
+NOINLINE void operator delete(void *p, size_t) noexcept { free(p); }
 
-    double getUnusedPercent() const
+// логарифмически-линейная гистограмма в духе HDR: значения меньше 32 нс получают по корзине,
+// каждая степень двойки выше делится на 32 равные части, поэтому перцентиль точен примерно до 3%
+class LatencyHistogram
+{
+    static const int subBits = 5;
+    static const int bucketCount = (64 - subBits + 1) << subBits;
+    atomic<uint64_t> buckets[bucketCount]{};
+    atomic<uint64_t> total{0}, sum{0}, largest{0};
+
+    static int bucketOf(uint64_t v)
     {
-        return totalWorkshops == 0 ? 0 : (double)(totalWorkshops - workingWorkshops) / totalWorkshops * 100;
+        if (v < (1u << subBits))
+            return (int)v;
+        int e = 0;
+        for (int step = 32; step; step >>= 1)
+            if (v >> (e + step))
+                e += step;
+        return ((e - subBits + 1) << subBits) + (int)((v >> (e - subBits)) & ((1 << subBits) - 1));
     }
-    void adjustWorkshops(int delta)
+
+    // наибольшее значение, попадающее в корзину b
+    static uint64_t upperBound(int b)
     {
-        workingWorkshops = max(0, min(totalWorkshops, workingWorkshops + delta));
+        if (b < (1 << subBits))
+            return b;
+        int e = (b >> subBits) + subBits - 1;
+        uint64_t sub = b & ((1 << subBits) - 1);
+        return ((1ull << e) | (sub << (e - subBits))) + (1ull << (e - subBits)) - 1;
+    }
+
+public:
+    void record(uint64_t ns)
+    {
+        buckets[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        sum.fetch_add(ns, memory_order_relaxed);
+        uint64_t seen = largest.load(memory_order_relaxed);
+        while (ns > seen && !largest.compare_exchange_weak(seen, ns, memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t sumNs() const { return sum.load(memory_order_relaxed); }
+    uint64_t maxNs() const { return largest.load(memory_order_relaxed); }
+
+    // q от 0 до 1; 0, если замеров не было
+    uint64_t percentile(double q) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(q * n)), seen = 0;
+        for (int b = 0; b < bucketCount; b++)
+        {
+            seen += buckets[b].load(memory_order_relaxed);
+            if (seen >= rank)
+                return min(upperBound(b), maxNs());
+        }
+        return maxNs();
     }
 };
 
-int CompressorStation::nextId = 0;
+struct OperationMetrics
+{
+    LatencyHistogram latency;
+    atomic<uint64_t> counters[MC_COUNT]{};
+};
 
-// ============ INPUT VALIDATION ============
-double readPositiveDouble(const string &prompt)
+OperationMetrics g_metrics[OP_COUNT];
+
+// замеряет время своей жизни и относит его вместе с приростом счетчиков к одной операции
+class ScopedTimer
 {
-    double value;
-    cout << prompt;
-    while (!(cin >> value) || value <= 0)
+    MetricOp op;
+    uint64_t base[MC_COUNT];
+    chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(MetricOp operation) : op(operation)
     {
-        cout << "Invalid input. Enter positive number: ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        for (int c = 0; c < MC_COUNT; c++)
+            base[c] = g_counters[c].load(memory_order_relaxed);
+        start = chrono::steady_clock::now();
     }
-    return value;
-}
+    ~ScopedTimer()
+    {
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        OperationMetrics &m = g_metrics[op];
+        m.latency.record((uint64_t)ns);
+        for (int c = 0; c < MC_COUNT; c++)
+            m.counters[c].fetch_add(g_counters[c].load(memory_order_relaxed) - base[c], memory_order_relaxed);
+    }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
 
-int readPositiveInt(const string &prompt)
+// компактный двоичный журнал событий (включается ключом --event-log): записи фиксированного размера
+// с кодом, ID объекта, счетчиком и временем; при превышении размера файл ротируется
+enum EventCode : uint16_t
 {
-    int value;
-    cout << prompt;
-    while (!(cin >> value) || value <= 0)
+    EV_PROGRAM_STARTED = 1,
+    EV_PROGRAM_EXITED,
+    EV_PIPE_ADDED,
+    EV_PIPE_DELETED,
+    EV_PIPE_REPAIR_TOGGLED,
+    EV_STATION_ADDED,
+    EV_WORKSHOP_STARTED,
+    EV_WORKSHOP_STOPPED,
+    EV_PIPE_SEARCH,
+    EV_STATION_SEARCH,
+    EV_SAVED,
+    EV_LOADED,
+    EV_CODE_COUNT
+};
+
+const char *const eventNames[EV_CODE_COUNT] = {"", "PROGRAM_STARTED", "PROGRAM_EXITED", "PIPE_ADDED", "PIPE_DELETED",
+                                               "PIPE_REPAIR_TOGGLED", "STATION_ADDED", "WORKSHOP_STARTED", "WORKSHOP_STOPPED",
+                                               "PIPE_SEARCH", "STATION_SEARCH", "SAVED", "LOADED"};
+
+struct EventRecord
+{
+    int64_t time;     // секунды unix; не убывают, даже если часы переведены назад
+    int64_t count;    // число затронутых или найденных записей
+    int32_t entityId; // 0 - без объекта
+    uint16_t code;
+    uint16_t reserved;
+};
+static_assert(sizeof(EventRecord) == 24, "event record layout is part of the file format");
+
+const char eventMagic[8] = {'P', 'I', 'P', 'E', 'E', 'V', 'T', '1'};
+
+class EventLog
+{
+    ofstream file;
+    string path;
+    uint64_t bytes = 0;
+    uint64_t maxBytes = 0;
+    int keep = 0;
+    int64_t lastTime = numeric_limits<int64_t>::min();
+    bool enabled = false;
+
+    // существующий файл дописывается, только если это журнал событий; оборванная при сбое
+    // запись отрезается, иначе все следующие легли бы со сдвигом. Чужой файл не трогается
+    bool openCurrent()
     {
-        cout << "Invalid input. Enter positive number: ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        // чтобы программа не падала и не зацикливалась при кривом вводе
+        uint64_t length = 0;
+        {
+            ifstream in(path, ios::binary | ios::ate);
+            if (in)
+            {
+                length = (uint64_t)in.tellg();
+                char magic[sizeof(eventMagic)];
+                size_t head = (size_t)min<uint64_t>(length, sizeof(magic));
+                in.seekg(0);
+                if (!in.read(magic, head) || memcmp(magic, eventMagic, head) != 0)
+                    return false;
+            }
+        }
+        uint64_t whole = length < sizeof(eventMagic)
+                             ? 0
+                             : sizeof(eventMagic) + (length - sizeof(eventMagic)) / sizeof(EventRecord) * sizeof(EventRecord);
+        error_code ec;
+        if (whole != length)
+            filesystem::resize_file(path, whole, ec);
+        if (ec)
+            return false;
+        if (whole > sizeof(eventMagic)) // метки продолжаются не раньше последней записанной
+        {
+            ifstream in(path, ios::binary);
+            EventRecord last;
+            if (in.seekg((streamoff)(whole - sizeof(EventRecord))) && in.read((char *)&last, sizeof(last)))
+                lastTime = max(lastTime, last.time);
+        }
+        file.open(path, ios::binary | ios::app);
+        bytes = whole;
+        if (bytes == 0)
+        {
+            file.write(eventMagic, sizeof(eventMagic));
+            bytes = sizeof(eventMagic);
+        }
+        return file.is_open();
     }
-    return value;
-}
 
-int readInt(const string &prompt, int minVal, int maxVal)
+    // path -> path.1 -> path.2 ...; самый старый файл сверх keep удаляется
+    void rotate()
+    {
+        file.close();
+        remove(rotatedName(path, keep).c_str());
+        for (int i = keep - 1; i >= 1; i--)
+            rename(rotatedName(path, i).c_str(), rotatedName(path, i + 1).c_str());
+        rename(path.c_str(), rotatedName(path, 1).c_str());
+        enabled = openCurrent();
+    }
+
+public:
+    static string rotatedName(const string &base, int generation)
+    {
+        return generation == 0 ? base : base + "." + to_string(generation);
+    }
+
+    bool enable(const string &filename = "pipeline_events.bin", uint64_t maxFileBytes = 16 << 20, int rotatedFiles = 3)
+    {
+        path = filename;
+        maxBytes = maxFileBytes;
+        keep = rotatedFiles;
+        enabled = openCurrent();
+        return enabled;
+    }
+
+    const string &filename() const { return path; }
+    int rotatedFiles() const { return keep; }
+
+    void record(EventCode code, int entityId = 0, int64_t count = 0)
+    {
+        if (!enabled)
+            return;
+        lastTime = max(lastTime, (int64_t)time(nullptr));
+        EventRecord r = {lastTime, count, entityId, (uint16_t)code, 0};
+        file.write((const char *)&r, sizeof(r));
+        bytes += sizeof(r);
+        if (bytes >= maxBytes)
+            rotate();
+    }
+
+    void flush()
+    {
+        if (enabled)
+            file.flush();
+    }
+};
+
+EventLog g_events;
+
+// файл, отображенный в память только для чтения
+class MappedFile
 {
-    int value;
-    cout << prompt;
-    while (!(cin >> value) || value < minVal || value > maxVal)
+    const char *base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    const char *data() const { return base; }
+    size_t size() const { return length; }
+
+    bool open(const string &filename)
     {
-        cout << "Invalid input. Enter number between " << minVal << " and " << maxVal << ": ";
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            close();
+            return false;
+        }
+        if (fileSize.QuadPart == 0) // пустой файл нельзя отобразить, он читается как пустой диапазон
+        {
+            close();
+            return true;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+            base = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!base)
+        {
+            close();
+            return false;
+        }
+        length = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        if (info.st_size == 0) // пустой файл нельзя отобразить, он читается как пустой диапазон
+        {
+            ::close(fd);
+            return true;
+        }
+        void *p = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        base = (const char *)p;
+        length = (size_t)info.st_size;
+#endif
+        return true;
     }
-    return value;
-}
 
-string readString(const string &prompt)
+    void close()
+    {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base)
+            munmap((void *)base, length);
+#endif
+        base = nullptr;
+        length = 0;
+    }
+};
+
+// журнал изменений (включается ключом --journal): каждое изменение дописывается компактной
+// двоичной записью [длина][контрольная сумма][операция][данные] в "<снимок>.journal";
+// записи одной операции меню сбрасываются на диск одним fsync (групповая фиксация)
+// записи несут итоговое состояние, поэтому повторное применение к более новому снимку безвредно
+enum JournalOp : uint8_t
 {
-    cout << prompt;
-    cin.ignore();
-    string result;
-    getline(cin, result);
-    return result;
+    JR_PIPE_PUT = 1,    // id, имя, длина, диаметр, ремонт
+    JR_PIPE_DELETE,     // id
+    JR_PIPE_REPAIR,     // id, ремонт
+    JR_STATION_PUT,     // id, имя, цехов, работает, класс
+    JR_STATION_WORKING, // id, работает
+    JR_RESET,           // без данных: реестры очищаются, следом идет все загруженное состояние
+};
+
+const char journalMagic[8] = {'P', 'I', 'P', 'E', 'J', 'R', 'N', '1'};
+
+uint32_t journalChecksum(const char *data, size_t size)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ (unsigned char)data[i]) * 16777619u;
+    return h;
 }
 
-//  PIPE OPERATIONS
-void addPipe(vector<Pipe> &pipes)
+// сборка данных одной записи
+struct JournalRecord
 {
-    Pipe pipe;
-    pipe.name = readString("Enter pipe name: ");
-    pipe.length = readPositiveDouble("Enter pipe length (km): ");
-    pipe.diameter = readPositiveInt("Enter pipe diameter (mm): ");
+    string data;
 
-    pipes.push_back(pipe);
-    cout << "Pipe added (ID: " << pipe.id << ")\n";
-    g_logger.log("Added pipe - ID: " + to_string(pipe.id) + ", Name: " + pipe.name);
-}
+    explicit JournalRecord(JournalOp op) { data.push_back((char)op); }
+    template <class N>
+    JournalRecord &put(N value)
+    {
+        data.append((const char *)&value, sizeof(value));
+        return *this;
+    }
+    JournalRecord &put(const string &text)
+    {
+        put((uint32_t)text.size());
+        data += text;
+        return *this;
+    }
+};
 
-void displayPipe(const Pipe &pipe)
+// чтение данных записи при воспроизведении; ok() ложно, если данных не хватило
+struct JournalReader
 {
-    cout << "[ID:" << pipe.id << "] " << pipe.name
-         << " | " << pipe.length << "km, Ø" << pipe.diameter << "mm"
-         << " | " << (pipe.underRepair ? "REPAIR" : "OK") << "\n";
+    const char *pos, *end;
+    bool good = true;
+
+    template <class N>
+    N get()
+    {
+        N value = N();
+        if (end - pos < (ptrdiff_t)sizeof(N))
+            good = false;
+        else
+        {
+            memcpy(&value, pos, sizeof(N));
+            pos += sizeof(N);
+        }
+        return value;
+    }
+    string getString()
+    {
+        uint32_t size = get<uint32_t>();
+        if (!good || (size_t)(end - pos) < size)
+        {
+            good = false;
+            return string();
+        }
+        string text(pos, size);
+        pos += size;
+        return text;
+    }
+    bool ok() const { return good; }
+};
+
+// применяет записи журнала по порядку; останавливается на первой оборванной или поврежденной
+// записи (хвост после сбоя) и возвращает длину целой части, 0 - журнала нет
+template <class Apply>
+uint64_t replayJournal(const string &path, size_t &applied, Apply apply)
+{
+    applied = 0;
+    MappedFile mapped;
+    if (!mapped.open(path) || mapped.size() < sizeof(journalMagic) || memcmp(mapped.data(), journalMagic, sizeof(journalMagic)) != 0)
+        return 0;
+    const char *base = mapped.data();
+    size_t pos = sizeof(journalMagic);
+    while (mapped.size() - pos >= 8)
+    {
+        uint32_t size, checksum;
+        memcpy(&size, base + pos, 4);
+        memcpy(&checksum, base + pos + 4, 4);
+        if (size == 0 || mapped.size() - pos - 8 < size || journalChecksum(base + pos + 8, size) != checksum)
+            break;
+        JournalReader reader = {base + pos + 9, base + pos + 8 + size};
+        apply((JournalOp)base[pos + 8], reader);
+        pos += 8 + size;
+        applied++;
+    }
+    return pos;
 }
 
-void displayAllPipes(const vector<Pipe> &pipes)
+class Journal
 {
-    if (pipes.empty())
+    string snapshot, path;
+    string pending;
+    uint64_t bytes = 0;
+    bool enabled = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+
+    bool writeAll(const char *data, size_t size)
     {
-        cout << "No pipes\n";
-        return;
+        size_t done = 0;
+        while (done < size)
+        {
+#ifdef _WIN32
+            DWORD n = 0;
+            if (!WriteFile(file, data + done, (DWORD)min<size_t>(size - done, 1u << 30), &n, nullptr) || n == 0)
+                return false;
+#else
+            ssize_t n = ::write(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+#endif
+            done += (size_t)n;
+        }
+        return true;
     }
-    cout << "\n=== PIPES ===\n";
-    for (const auto &p : pipes)
-        displayPipe(p);
+
+    bool sync()
+    {
+#ifdef _WIN32
+        return FlushFileBuffers(file) != 0;
+#else
+        return fsync(fd) == 0;
+#endif
+    }
+
+    // обрезает файл до length и ставит позицию записи в конец
+    bool truncateTo(uint64_t length)
+    {
+#ifdef _WIN32
+        LARGE_INTEGER at;
+        at.QuadPart = (LONGLONG)length;
+        return SetFilePointerEx(file, at, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+        return ftruncate(fd, (off_t)length) == 0 && lseek(fd, (off_t)length, SEEK_SET) == (off_t)length;
+#endif
+    }
+
+public:
+    ~Journal()
+    {
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    static string journalName(const string &snapshotName) { return snapshotName + ".journal"; }
+
+    // открывает журнал для дописывания; validLength - целая часть после воспроизведения,
+    // оборванный хвост отрезается
+    bool open(const string &snapshotName, uint64_t validLength)
+    {
+        snapshot = snapshotName;
+        path = journalName(snapshotName);
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+#endif
+        enabled = true;
+        if (validLength < sizeof(journalMagic))
+            return reset();
+        bytes = validLength;
+        return truncateTo(validLength) && sync();
+    }
+
+    bool active() const { return enabled; }
+    const string &snapshotName() const { return snapshot; }
+    uint64_t size() const { return bytes + pending.size(); }
+    size_t pendingSize() const { return pending.size(); }
+
+    void append(const JournalRecord &record)
+    {
+        if (!enabled)
+            return;
+        uint32_t size = (uint32_t)record.data.size();
+        uint32_t checksum = journalChecksum(record.data.data(), size);
+        pending.append((const char *)&size, 4);
+        pending.append((const char *)&checksum, 4);
+        pending += record.data;
+    }
+
+    // одна запись в файл и один fsync на все накопленные изменения
+    // при ошибке недописанная пачка отрезается, чтобы новые записи не легли за оборванной
+    // (воспроизведение остановилось бы на ней), а изменения остаются для следующей фиксации;
+    // если файл не удается обрезать, журнал отключается
+    bool commit()
+    {
+        if (!enabled || pending.empty())
+            return true;
+        if (!writeAll(pending.data(), pending.size()) || !sync())
+        {
+            if (!truncateTo(bytes))
+            {
+                enabled = false;
+                cerr << "Error: journal '" << path << "' cannot be repaired after a failed write, journaling stopped\n";
+            }
+            return false;
+        }
+        countMetric(MC_BYTES_WRITTEN, pending.size());
+        bytes += pending.size();
+        pending.clear();
+        return true;
+    }
+
+    // начинает журнал заново после того, как снимок переписан
+    bool reset()
+    {
+        if (!enabled)
+            return true;
+        pending.clear();
+        bytes = sizeof(journalMagic);
+        return truncateTo(0) && writeAll(journalMagic, sizeof(journalMagic)) && sync();
+    }
+};
+
+Journal g_journal;
+const uint64_t journalCompactBytes = 8 << 20; // после такого размера журнал сворачивается в снимок
+
+// выдаёт возрастающие ID и никогда не повторяет уже встречавшийся, в том числе загруженный из файла
+struct IdAllocator
+{
+    int last = 0;
+
+    int next() { return ++last; }
+    void observe(int id) { last = max(last, id); }
+};
+
+// хеш-индекс ID -> позиция записи: открытая адресация с линейным пробированием,
+// таблица степени двойки заполнена не больше чем наполовину, при удалении ставится метка
+class IdIndex
+{
+    enum : uint8_t
+    {
+        EMPTY, LIVE, DELETED
+    };
+    vector<int> keys;
+    vector<uint8_t> state; // занятость ячейки хранится отдельно, поэтому допустим любой ID
+    vector<size_t> slots;
+    size_t live = 0;
+    size_t filled = 0; // живые записи плюс метки удаления
+
+    size_t home(int id) const { return ((uint32_t)id * 2654435769u) & (keys.size() - 1); }
+
+    void rehash(size_t want)
+    {
+        size_t capacity = 16;
+        while (capacity < want * 2)
+            capacity <<= 1;
+        vector<int> oldKeys(capacity);
+        vector<uint8_t> oldState(capacity, EMPTY);
+        vector<size_t> oldSlots(capacity);
+        oldKeys.swap(keys);
+        oldState.swap(state);
+        oldSlots.swap(slots);
+        live = filled = 0;
+        for (size_t i = 0; i < oldKeys.size(); i++)
+            if (oldState[i] == LIVE)
+                put(oldKeys[i], oldSlots[i]);
+    }
+
+    long probe(int id) const
+    {
+        if (keys.empty())
+            return -1;
+        for (size_t i = home(id);; i = (i + 1) & (keys.size() - 1))
+        {
+            if (state[i] == EMPTY)
+                return -1;
+            if (state[i] == LIVE && keys[i] == id)
+                return (long)i;
+        }
+    }
+
+public:
+    size_t size() const { return live; }
+
+    void clear()
+    {
+        keys.clear();
+        state.clear();
+        slots.clear();
+        live = filled = 0;
+    }
+
+    void reserve(size_t count)
+    {
+        if (count * 2 > keys.size())
+            rehash(count);
+    }
+
+    // вставка или обновление; false если такой ID уже был
+    bool put(int id, size_t slot)
+    {
+        if ((filled + 1) * 2 > keys.size())
+            rehash(live + 1);
+        size_t mask = keys.size() - 1;
+        long tombstone = -1;
+        size_t i = home(id);
+        for (; state[i] != EMPTY; i = (i + 1) & mask)
+        {
+            if (state[i] == LIVE && keys[i] == id)
+            {
+                slots[i] = slot;
+                return false;
+            }
+            if (state[i] == DELETED && tombstone < 0)
+                tombstone = (long)i;
+        }
+        if (tombstone >= 0)
+            i = (size_t)tombstone;
+        else
+            filled++;
+        keys[i] = id;
+        state[i] = LIVE;
+        slots[i] = slot;
+        live++;
+        return true;
+    }
+
+    long find(int id) const
+    {
+        long i = probe(id);
+        return i < 0 ? -1 : (long)slots[i];
+    }
+
+    bool erase(int id)
+    {
+        long i = probe(id);
+        if (i < 0)
+            return false;
+        state[i] = DELETED;
+        live--;
+        return true;
+    }
+};
+
+// поколенческий дескриптор: дешево копируется и распознает запись, удаленную после его получения
+struct Handle
+{
+    uint32_t slot = 0;
+    uint32_t generation = 0; // у живых записей поколение нечетное, поэтому 0 никогда не действителен
+};
+
+// слаб из блоков фиксированного размера: записи строятся на месте и никогда не перемещаются,
+// указатели и дескрипторы переживают любые добавления; освобожденные слоты используются повторно
+template <class T>
+class Slab
+{
+    static const size_t chunkSize = 1024;
+    struct Cell
+    {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+    vector<unique_ptr<Cell[]>> chunks;
+    vector<uint32_t> generations;
+    vector<uint32_t> freeSlots;
+
+    T *at(size_t slot) const { return reinterpret_cast<T *>(chunks[slot / chunkSize][slot % chunkSize].bytes); }
+
+public:
+    Slab() {}
+    Slab(const Slab &) = delete;
+    Slab &operator=(const Slab &) = delete;
+    Slab(Slab &&other) noexcept { *this = move(other); }
+    Slab &operator=(Slab &&other) noexcept
+    {
+        if (this != &other)
+        {
+            clear();
+            chunks.swap(other.chunks);
+            generations.swap(other.generations);
+            freeSlots.swap(other.freeSlots);
+        }
+        return *this;
+    }
+    ~Slab() { clear(); }
+
+    size_t slotCount() const { return generations.size(); }
+    bool alive(size_t slot) const { return slot < generations.size() && (generations[slot] & 1); }
+    T &operator[](size_t slot) { return *at(slot); }
+    const T &operator[](size_t slot) const { return *at(slot); }
+    Handle handleAt(uint32_t slot) const { return {slot, generations[slot]}; }
+
+    bool valid(Handle h) const { return h.slot < generations.size() && generations[h.slot] == h.generation && (h.generation & 1); }
+    T *get(Handle h) { return valid(h) ? at(h.slot) : nullptr; }
+    const T *get(Handle h) const { return valid(h) ? at(h.slot) : nullptr; }
+
+    template <class U>
+    Handle insert(U &&value)
+    {
+        uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slot = (uint32_t)generations.size();
+            if (slot % chunkSize == 0)
+                chunks.emplace_back(new Cell[chunkSize]);
+            generations.push_back(0);
+        }
+        new (at(slot)) T(forward<U>(value));
+        generations[slot]++;
+        return {slot, generations[slot]};
+    }
+
+    void erase(uint32_t slot)
+    {
+        at(slot)->~T();
+        generations[slot]++;
+        freeSlots.push_back(slot);
+    }
+
+    void clear()
+    {
+        for (size_t slot = 0; slot < generations.size(); slot++)
+            if (generations[slot] & 1)
+                at(slot)->~T();
+        chunks.clear();
+        generations.clear();
+        freeSlots.clear();
+    }
+};
+
+// записи в слабе плюс индекс по ID и список живых слотов в порядке добавления
+// слот записи не меняется за все время ее жизни, обход идет в порядке добавления
+template <class T>
+class Registry
+{
+    Slab<T> slab;
+    IdIndex index;
+    vector<uint32_t> order;
+
+    template <class Ref, class SlabPtr>
+    struct Iter
+    {
+        const uint32_t *pos;
+        SlabPtr slab;
+
+        Ref operator*() const { return (*slab)[*pos]; }
+        Iter &operator++()
+        {
+            ++pos;
+            return *this;
+        }
+        bool operator!=(const Iter &other) const { return pos != other.pos; }
+    };
+
+public:
+    typedef Iter<T &, Slab<T> *> iterator;
+    typedef Iter<const T &, const Slab<T> *> const_iterator;
+
+    size_t size() const { return order.size(); }
+    bool empty() const { return order.empty(); }
+    T *get(Handle h) { return slab.get(h); }
+    const T *get(Handle h) const { return slab.get(h); }
+    iterator begin() { return {order.data(), &slab}; }
+    iterator end() { return {order.data() + order.size(), &slab}; }
+    const_iterator begin() const { return {order.data(), &slab}; }
+    const_iterator end() const { return {order.data() + order.size(), &slab}; }
+
+    void reserve(size_t count)
+    {
+        order.reserve(count);
+        index.reserve(count);
+    }
+
+    Handle add(const T &record) { return add(T(record)); }
+    Handle add(T &&record)
+    {
+        int id = record.id;
+        Handle h = slab.insert(move(record));
+        bool added = index.put(id, h.slot);
+        assert(added && "Registry::add with an ID that is already stored");
+        (void)added;
+        order.push_back(h.slot);
+        return h;
+    }
+
+    bool contains(int id) const { return index.find(id) >= 0; }
+
+    T *find(int id)
+    {
+        long slot = index.find(id);
+        return slot < 0 ? nullptr : &slab[slot];
+    }
+
+    Handle handleOf(int id) const
+    {
+        long slot = index.find(id);
+        return slot < 0 ? Handle() : slab.handleAt((uint32_t)slot);
+    }
+
+    // удаляет запись; порядок остальных сохраняется, их слоты и дескрипторы остаются действительными
+    bool erase(int id)
+    {
+        long slot = index.find(id);
+        if (slot < 0)
+            return false;
+        order.erase(find_if(order.begin(), order.end(), [&](uint32_t s) { return s == (uint32_t)slot; }));
+        index.erase(id);
+        slab.erase((uint32_t)slot);
+        return true;
+    }
+
+    // массовое удаление за один проход: список порядка уплотняется, удаляемые записи
+    // освобождаются в слабе и убираются из индекса; возвращает число удаленных
+    size_t eraseAll(const IdIndex &doomed)
+    {
+        size_t kept = 0;
+        for (uint32_t slot : order)
+        {
+            int id = slab[slot].id;
+            if (doomed.find(id) >= 0)
+            {
+                index.erase(id);
+                slab.erase(slot);
+            }
+            else
+                order[kept++] = slot;
+        }
+        size_t removed = order.size() - kept;
+        order.resize(kept);
+        return removed;
+    }
+
+    // заменяет все записи (загрузка); false если ID повторяются, тогда реестр не меняется
+    bool assign(vector<T> &&loaded)
+    {
+        Registry fresh;
+        fresh.reserve(loaded.size());
+        for (auto &record : loaded)
+        {
+            if (fresh.contains(record.id))
+                return false;
+            fresh.add(move(record));
+        }
+        *this = move(fresh);
+        return true;
+    }
+};
+
+// триграммный индекс имен для поиска по подстроке: списки ID на каждую триграмму,
+// запрос пересекает списки своих триграмм и проверяет кандидатов find'ом
+// ID выдаются по возрастанию, поэтому списки остаются отсортированными без сортировки при добавлении
+class NameIndex
+{
+    unordered_map<uint32_t, vector<int>> postings;
+    size_t live = 0;
+    size_t stale = 0; // удаленные записи, которые еще числятся в списках
+
+    static vector<uint32_t> grams(const string &text)
+    {
+        vector<uint32_t> result;
+        for (size_t i = 0; i + 3 <= text.size(); i++)
+            result.push_back((uint32_t)(unsigned char)text[i] << 16 | (uint32_t)(unsigned char)text[i + 1] << 8 | (unsigned char)text[i + 2]);
+        sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+public:
+    void add(int id, const string &name)
+    {
+        for (uint32_t g : grams(name))
+            postings[g].push_back(id);
+        live++;
+    }
+
+    // удаление ленивое: устаревшие ID отсеиваются проверкой, индекс перестраивается,
+    // когда их становится больше, чем живых
+    template <class T>
+    void removed(const Registry<T> &records, size_t count)
+    {
+        stale += count;
+        live -= min(live, count);
+        if (stale > live)
+            rebuild(records);
+    }
+
+    template <class T>
+    void rebuild(const Registry<T> &records)
+    {
+        postings.clear();
+        live = stale = 0;
+        for (const auto &record : records)
+            add(record.id, record.name);
+        for (auto &entry : postings) // после загрузки порядок ID произвольный
+            sort(entry.second.begin(), entry.second.end());
+    }
+
+    template <class T>
+    vector<Handle> search(const Registry<T> &records, const string &fragment) const
+    {
+        vector<Handle> results;
+        if (fragment.size() < 3) // короче триграммы: полный просмотр
+        {
+            countMetric(MC_SCANNED, records.size());
+            for (const auto &record : records)
+                if (record.name.find(fragment) != string::npos)
+                    results.push_back(records.handleOf(record.id));
+            return results;
+        }
+
+        vector<const vector<int> *> lists;
+        for (uint32_t g : grams(fragment))
+        {
+            auto it = postings.find(g);
+            if (it == postings.end())
+                return results;
+            lists.push_back(&it->second);
+        }
+        sort(lists.begin(), lists.end(), [](const vector<int> *a, const vector<int> *b)
+             { return a->size() < b->size(); });
+
+        vector<int> candidates = *lists[0], next;
+        for (size_t i = 1; i < lists.size() && !candidates.empty(); i++)
+        {
+            next.clear();
+            set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(), back_inserter(next));
+            candidates.swap(next);
+        }
+
+        countMetric(MC_SCANNED, candidates.size());
+        for (int id : candidates)
+        {
+            Handle h = records.handleOf(id);
+            const T *record = records.get(h);
+            if (record && record->name.find(fragment) != string::npos)
+                results.push_back(h);
+        }
+        return results;
+    }
+};
+
+// структуры
+struct Pipe
+{
+    static IdAllocator ids;
+    int id;
+    string name;
+    double length;
+    int diameter;
+    bool underRepair;
+
+    Pipe() : id(ids.next()), length(0), diameter(0), underRepair(false) {}
+    // для записей из файла: ID сохраняется и резервируется в аллокаторе
+    explicit Pipe(int loadedId) : id(loadedId), length(0), diameter(0), underRepair(false) { ids.observe(loadedId); }
+    // функции валидации ввода
+    double getLength() const { return length; }
+    int getDiameter() const { return diameter; }
+    bool isUnderRepair() const { return underRepair; }
+    void setRepairStatus(bool status) { underRepair = status; }
+};
+
+IdAllocator Pipe::ids;
+
+struct CompressorStation
+{
+    static IdAllocator ids;
+    int id;
+    string name;
+    int totalWorkshops;
+    int workingWorkshops;
+    int stationClass;
+
+    CompressorStation() : id(ids.next()), totalWorkshops(0), workingWorkshops(0), stationClass(0) {}
+    explicit CompressorStation(int loadedId) : id(loadedId), totalWorkshops(0), workingWorkshops(0), stationClass(0) { ids.observe(loadedId); }
+
+    double getUnusedPercent() const
+    {
+        return totalWorkshops == 0 ? 0 : (double)(totalWorkshops - workingWorkshops) / totalWorkshops * 100;
+    }
+    void adjustWorkshops(int delta)
+    {
+        workingWorkshops = max(0, min(totalWorkshops, workingWorkshops + delta));
+    }
+};
+
+IdAllocator CompressorStation::ids;
+
+// упорядоченный индекс станций по доле простаивающих цехов, общий и по классам
+// процент считается один раз при записи; диапазон и top-K берутся от границы дерева за O(log N + K)
+class UtilisationIndex
+{
+    typedef pair<double, int> Key; // процент простоя, ID
+    set<Key> all;
+    map<int, set<Key>> byClass;
+    unordered_map<int, pair<Key, int>> filed; // ID -> ключ и класс, под которыми станция записана
+
+    static vector<Handle> handles(const Registry<CompressorStation> &stations, const vector<int> &ids)
+    {
+        vector<Handle> results;
+        for (int id : ids)
+            results.push_back(stations.handleOf(id));
+        return results;
+    }
+
+public:
+    // добавляет станцию или перезаписывает ее после изменения
+    void put(const CompressorStation &st)
+    {
+        auto it = filed.find(st.id);
+        if (it != filed.end())
+        {
+            all.erase(it->second.first);
+            byClass[it->second.second].erase(it->second.first);
+        }
+        Key key(st.getUnusedPercent(), st.id);
+        all.insert(key);
+        byClass[st.stationClass].insert(key);
+        filed[st.id] = make_pair(key, st.stationClass);
+    }
+
+    // запуск или остановка цехов только через индекс, чтобы он не устаревал
+    void adjustWorkshops(CompressorStation &st, int delta)
+    {
+        st.adjustWorkshops(delta);
+        put(st);
+    }
+
+    void rebuild(const Registry<CompressorStation> &stations)
+    {
+        all.clear();
+        byClass.clear();
+        filed.clear();
+        for (const auto &st : stations)
+            put(st);
+    }
+
+    // станции с простоем в [minPercent, maxPercent], по возрастанию простоя
+    vector<Handle> range(const Registry<CompressorStation> &stations, double minPercent, double maxPercent) const
+    {
+        vector<int> ids;
+        for (auto it = all.lower_bound(Key(minPercent, numeric_limits<int>::min())); it != all.end() && it->first <= maxPercent; ++it)
+            ids.push_back(it->second);
+        return handles(stations, ids);
+    }
+
+    // k наименее загруженных станций (наибольший простой); класс 0 - любой
+    vector<Handle> leastUtilised(const Registry<CompressorStation> &stations, size_t k, int stationClass) const
+    {
+        ScopedTimer timer(OP_SEARCH);
+        const set<Key> *keys = &all;
+        if (stationClass != 0)
+        {
+            auto cls = byClass.find(stationClass);
+            if (cls == byClass.end())
+                return vector<Handle>();
+            keys = &cls->second;
+        }
+        vector<int> ids;
+        for (auto it = keys->rbegin(); it != keys->rend() && ids.size() < k; ++it)
+            ids.push_back(it->second);
+        countMetric(MC_SCANNED, ids.size());
+        return handles(stations, ids);
+    }
+};
+
+// ============ INPUT VALIDATION ============
+double readPositiveDouble(const string &prompt)
+{
+    double value;
+    cout << prompt;
+    while (!(cin >> value) || value <= 0)
+    {
+        cout << "Invalid input. Enter positive number: ";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    return value;
+}
+
+int readPositiveInt(const string &prompt)
+{
+    int value;
+    cout << prompt;
+    while (!(cin >> value) || value <= 0)
+    {
+        cout << "Invalid input. Enter positive number: ";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        // чтобы программа не падала и не зацикливалась при кривом вводе
+    }
+    return value;
+}
+
+int readInt(const string &prompt, int minVal, int maxVal)
+{
+    int value;
+    cout << prompt;
+    while (!(cin >> value) || value < minVal || value > maxVal)
+    {
+        cout << "Invalid input. Enter number between " << minVal << " and " << maxVal << ": ";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    return value;
+}
+
+string readString(const string &prompt)
+{
+    cout << prompt;
+    cin.ignore();
+    string result;
+    getline(cin, result);
+    return result;
+}
+
+//  PIPE OPERATIONS
+void journalPipe(const Pipe &pipe)
+{
+    g_journal.append(JournalRecord(JR_PIPE_PUT).put(pipe.id).put(pipe.name).put(pipe.length).put(pipe.diameter).put(pipe.underRepair));
+}
+
+// добавление без диалога: реестр, индекс имен, журнал и логи
+void storePipe(Registry<Pipe> &pipes, NameIndex &names, const Pipe &pipe)
+{
+    ScopedTimer timer(OP_ADD);
+    pipes.add(pipe);
+    names.add(pipe.id, pipe.name);
+    journalPipe(pipe);
+    g_logger.log("Added pipe - ID: " + to_string(pipe.id) + ", Name: " + pipe.name);
+    g_events.record(EV_PIPE_ADDED, pipe.id, 1);
+}
+
+void addPipe(Registry<Pipe> &pipes, NameIndex &names)
+{
+    Pipe pipe;
+    pipe.name = readString("Enter pipe name: ");
+    pipe.length = readPositiveDouble("Enter pipe length (km): ");
+    pipe.diameter = readPositiveInt("Enter pipe diameter (mm): ");
+
+    storePipe(pipes, names, pipe);
+    cout << "Pipe added (ID: " << pipe.id << ")\n";
+}
+
+void displayPipe(const Pipe &pipe)
+{
+    cout << "[ID:" << pipe.id << "] " << pipe.name
+         << " | " << pipe.length << "km, Ø" << pipe.diameter << "mm"
+         << " | " << (pipe.underRepair ? "REPAIR" : "OK") << "\n";
+}
+
+void displayAllPipes(const Registry<Pipe> &pipes)
+{
+    if (pipes.empty())
+    {
+        cout << "No pipes\n";
+        return;
+    }
+    cout << "\n=== PIPES ===\n";
+    for (const auto &p : pipes)
+        displayPipe(p);
+}
+
+vector<Handle> searchPipesByName(const Registry<Pipe> &pipes, const NameIndex &names, const string &name) // дескрипторы остаются проверяемыми после удалений
+{
+    ScopedTimer timer(OP_SEARCH);
+    vector<Handle> results = names.search(pipes, name);
+    g_logger.log("Search pipes by name: '" + name + "' -> " + to_string(results.size()));
+    g_events.record(EV_PIPE_SEARCH, 0, results.size());
+    return results;
+}
+
+vector<Handle> searchPipesByRepair(const Registry<Pipe> &pipes, bool repair)
+{
+    ScopedTimer timer(OP_SEARCH);
+    vector<Handle> results;
+    for (const auto &p : pipes)
+        if (p.underRepair == repair)
+            results.push_back(pipes.handleOf(p.id));
+    countMetric(MC_SCANNED, pipes.size());
+    g_logger.log("Search pipes by repair: " + string(repair ? "yes" : "no") + " -> " + to_string(results.size()));
+    g_events.record(EV_PIPE_SEARCH, 0, results.size());
+    return results;
+}
+
+size_t deletePipesFromVector(Registry<Pipe> &pipes, NameIndex &names, const vector<Handle> &toDelete)
+{
+    ScopedTimer timer(OP_EDIT);
+    IdIndex doomed; // множество ID к удалению, уже удаленные и повторы отсеиваются
+    doomed.reserve(toDelete.size());
+    for (Handle h : toDelete)
+        if (Pipe *p = pipes.get(h))
+            if (doomed.put(p->id, 0))
+            {
+                g_events.record(EV_PIPE_DELETED, p->id, 1);
+                g_journal.append(JournalRecord(JR_PIPE_DELETE).put(p->id));
+            }
+    size_t removed = pipes.eraseAll(doomed);
+    names.removed(pipes, removed);
+    return removed;
+}
+
+size_t togglePipesRepair(Registry<Pipe> &pipes, const vector<Handle> &selected)
+{
+    ScopedTimer timer(OP_EDIT);
+    IdIndex seen; // повторы в выборке переключаются один раз, как и при удалении
+    seen.reserve(selected.size());
+    size_t toggled = 0;
+    for (Handle h : selected)
+        if (Pipe *p = pipes.get(h))
+        {
+            if (!seen.put(p->id, 0))
+                continue;
+            p->underRepair = !p->underRepair;
+            g_events.record(EV_PIPE_REPAIR_TOGGLED, p->id, p->underRepair);
+            g_journal.append(JournalRecord(JR_PIPE_REPAIR).put(p->id).put(p->underRepair));
+            toggled++;
+        }
+    g_logger.log("Batch: toggled repair on " + to_string(toggled) + " pipe(s)");
+    return toggled;
+}
+
+void batchEditPipes(Registry<Pipe> &pipes, NameIndex &names, vector<Handle> &results, int action)
+{
+    if (results.empty())
+    {
+        cout << "No pipes found\n";
+        return;
+    }
+
+    cout << "\nFound " << results.size() << " pipe(s):\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        cout << (i + 1) << ". ";
+        displayPipe(*pipes.get(results[i]));
+    }
+
+    cout << "\n1=Edit all, 2=Select, 0=Cancel: ";
+    int choice;
+    cin >> choice;
+
+    vector<Handle> selected;
+    if (choice == 1)
+        selected = results;
+    else if (choice == 2)
+    {
+        cout << "Enter numbers (1-" << results.size() << ") space-separated: ";
+        cin.ignore();
+        string input;
+        getline(cin, input);
+        istringstream iss(input);
+        int num;
+        while (iss >> num)
+            if (num > 0 && num <= (int)results.size())
+                selected.push_back(results[num - 1]);
+    }
+    else
+        return;
+
+    if (action == 1)
+    {
+        size_t toggled = togglePipesRepair(pipes, selected);
+        cout << "Repair status changed: " << toggled << " pipe(s)\n";
+    }
+    else if (action == 2)
+    {
+        cout << "Delete " << selected.size() << " pipe(s)? (y/n): ";
+        char c;
+        cin >> c;
+        if (c == 'y' || c == 'Y')
+        {
+            size_t removed = deletePipesFromVector(pipes, names, selected);
+            cout << "Deleted: " << removed << " pipe(s)\n";
+            g_logger.log("Batch: deleted " + to_string(removed) + " pipe(s)");
+        }
+    }
+}
+
+// ============ STATION OPERATIONS ============
+void journalStation(const CompressorStation &st)
+{
+    g_journal.append(JournalRecord(JR_STATION_PUT).put(st.id).put(st.name).put(st.totalWorkshops).put(st.workingWorkshops).put(st.stationClass));
+}
+
+void storeStation(Registry<CompressorStation> &stations, NameIndex &names, UtilisationIndex &utilisation, const CompressorStation &st)
+{
+    ScopedTimer timer(OP_ADD);
+    stations.add(st);
+    names.add(st.id, st.name);
+    utilisation.put(st);
+    journalStation(st);
+    g_logger.log("Added station - ID: " + to_string(st.id) + ", Name: " + st.name);
+    g_events.record(EV_STATION_ADDED, st.id, 1);
+}
+
+void addStation(Registry<CompressorStation> &stations, NameIndex &names, UtilisationIndex &utilisation)
+{
+    CompressorStation st;
+    st.name = readString("Enter station name: ");
+    st.totalWorkshops = readPositiveInt("Enter total workshops: ");
+    st.workingWorkshops = readInt("Enter working workshops: ", 0, st.totalWorkshops);
+    st.stationClass = readPositiveInt("Enter station class: ");
+
+    storeStation(stations, names, utilisation, st);
+    cout << "Station added (ID: " << st.id << ")\n";
+}
+
+void displayStation(const CompressorStation &st)
+{
+    cout << "[ID:" << st.id << "] " << st.name
+         << " | " << st.workingWorkshops << "/" << st.totalWorkshops << " working"
+         << " | Unused: " << fixed << (int)st.getUnusedPercent() << "%"
+         << " | Class:" << st.stationClass << "\n";
+}
+
+void displayAllStations(const Registry<CompressorStation> &stations)
+{
+    if (stations.empty())
+    {
+        cout << "No stations\n";
+        return;
+    }
+    cout << "\n=== STATIONS ===\n";
+    for (const auto &s : stations)
+        displayStation(s);
+}
+
+vector<Handle> searchStationsByName(const Registry<CompressorStation> &stations, const NameIndex &names, const string &name)
+{
+    ScopedTimer timer(OP_SEARCH);
+    vector<Handle> results = names.search(stations, name);
+    g_logger.log("Search stations by name: '" + name + "' -> " + to_string(results.size()));
+    g_events.record(EV_STATION_SEARCH, 0, results.size());
+    return results;
+}
+
+vector<Handle> searchStationsByUnused(const Registry<CompressorStation> &stations, const UtilisationIndex &utilisation, double minPercent)
+{
+    ScopedTimer timer(OP_SEARCH);
+    vector<Handle> results = utilisation.range(stations, minPercent, 100);
+    countMetric(MC_SCANNED, results.size());
+    g_logger.log("Search stations by unused >= " + to_string((int)minPercent) + "% -> " + to_string(results.size()));
+    g_events.record(EV_STATION_SEARCH, 0, results.size());
+    return results;
+}
+
+// запуск (+1) или остановка (-1) цеха
+void changeWorkshops(CompressorStation &st, UtilisationIndex &utilisation, int delta)
+{
+    ScopedTimer timer(OP_EDIT);
+    utilisation.adjustWorkshops(st, delta);
+    g_logger.log("Station " + to_string(st.id) + (delta > 0 ? ": started workshop" : ": stopped workshop"));
+    g_events.record(delta > 0 ? EV_WORKSHOP_STARTED : EV_WORKSHOP_STOPPED, st.id, st.workingWorkshops);
+    g_journal.append(JournalRecord(JR_STATION_WORKING).put(st.id).put(st.workingWorkshops));
+}
+
+void editStation(CompressorStation &st, UtilisationIndex &utilisation)
+{
+    cout << "1=Start workshop, 2=Stop workshop, 0=Back: ";
+    int choice;
+    cin >> choice;
+    if (choice == 1 || choice == 2)
+    {
+        changeWorkshops(st, utilisation, choice == 1 ? 1 : -1);
+        cout << "Working: " << st.workingWorkshops << "/" << st.totalWorkshops << "\n";
+    }
+}
+
+// ============ FILE I/O ============
+// разбор числа из поля целиком, без копирования и без учета локали
+template <class N>
+bool parseField(string_view field, N &out)
+{
+    const char *end = field.data() + field.size();
+    auto result = from_chars(field.data(), end, out);
+    return result.ec == errc() && result.ptr == end;
+}
+
+// делит строку записи на 5 полей: ID и три последних поля отделяются по краям,
+// поэтому имя может содержать '|'
+bool splitRecord(string_view line, string_view fields[5])
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    size_t p1 = line.find('|');
+    size_t p4 = line.rfind('|');
+    if (p1 == string_view::npos || p4 == 0)
+        return false;
+    size_t p3 = line.rfind('|', p4 - 1);
+    if (p3 == string_view::npos || p3 == 0)
+        return false;
+    size_t p2 = line.rfind('|', p3 - 1);
+    if (p2 == string_view::npos || p2 <= p1)
+        return false;
+    fields[0] = line.substr(0, p1);
+    fields[1] = line.substr(p1 + 1, p2 - p1 - 1);
+    fields[2] = line.substr(p2 + 1, p3 - p2 - 1);
+    fields[3] = line.substr(p3 + 1, p4 - p3 - 1);
+    fields[4] = line.substr(p4 + 1);
+    return true;
+}
+
+struct ParsedPipe
+{
+    int id;
+    string_view name; // указывает в отображенный файл
+    double length;
+    int diameter;
+    int repair;
+};
+
+struct ParsedStation
+{
+    int id;
+    string_view name;
+    int total, working, cls;
+};
+
+bool parseRecord(string_view line, ParsedPipe &r)
+{
+    string_view f[5];
+    if (!splitRecord(line, f))
+        return false;
+    r.name = f[1];
+    return parseField(f[0], r.id) && parseField(f[2], r.length) && parseField(f[3], r.diameter) && parseField(f[4], r.repair);
+}
+
+bool parseRecord(string_view line, ParsedStation &r)
+{
+    string_view f[5];
+    if (!splitRecord(line, f))
+        return false;
+    r.name = f[1];
+    return parseField(f[0], r.id) && parseField(f[2], r.total) && parseField(f[3], r.working) && parseField(f[4], r.cls);
+}
+
+// тело секции делится на куски по границам строк, куски разбираются параллельно,
+// результаты складываются по кускам, чтобы при слиянии сохранился порядок файла
+template <class Rec>
+vector<vector<Rec>> parseSection(string_view body, size_t &bad)
+{
+    const size_t minChunk = 1 << 20;
+    size_t threads = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), body.size() / minChunk));
+    vector<size_t> bounds(threads + 1, body.size());
+    bounds[0] = 0;
+    for (size_t t = 1; t < threads; t++)
+    {
+        size_t cut = body.find('\n', body.size() / threads * t);
+        bounds[t] = cut == string_view::npos ? body.size() : max(cut + 1, bounds[t - 1]);
+    }
+
+    vector<vector<Rec>> parts(threads);
+    vector<size_t> badParts(threads, 0);
+    auto work = [&](size_t t)
+    {
+        string_view chunk = body.substr(bounds[t], bounds[t + 1] - bounds[t]);
+        parts[t].reserve(chunk.size() / 24);
+        while (!chunk.empty())
+        {
+            size_t eol = chunk.find('\n');
+            string_view line = chunk.substr(0, eol);
+            chunk.remove_prefix(eol == string_view::npos ? chunk.size() : eol + 1);
+            if (line.empty() || line == "\r")
+                continue;
+            Rec r;
+            if (parseRecord(line, r))
+                parts[t].push_back(r);
+            else
+                badParts[t]++;
+        }
+    };
+    vector<thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(work, t);
+    work(0);
+    for (auto &th : pool)
+        th.join();
+    for (size_t n : badParts)
+        bad += n;
+    return parts;
+}
+
+// запись файла без риска оставить его недописанным: данные идут через большой буфер
+// во временный "<имя>.tmp", который сбрасывается на диск и атомарно переименовывается поверх цели;
+// незафиксированный временный файл удаляется в деструкторе
+class SafeFileWriter
+{
+    string target, temp;
+    string buffer;
+    bool failed = false;
+    bool committed = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+    static const size_t bufferSize = 1 << 20;
+
+    void writeRaw(const char *data, size_t size)
+    {
+        size_t done = 0;
+        while (!failed && done < size)
+        {
+#ifdef _WIN32
+            DWORD n = 0;
+            DWORD chunk = (DWORD)min<size_t>(size - done, 1u << 30);
+            if (!WriteFile(file, data + done, chunk, &n, nullptr) || n == 0)
+                failed = true;
+#else
+            ssize_t n = ::write(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                failed = true;
+#endif
+            else
+                done += (size_t)n;
+        }
+        countMetric(MC_BYTES_WRITTEN, done);
+    }
+
+    void writeOut()
+    {
+        writeRaw(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    void closeFile()
+    {
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+    }
+
+public:
+    explicit SafeFileWriter(const string &filename) : target(filename), temp(filename + ".tmp")
+    {
+        buffer.reserve(bufferSize);
+#ifdef _WIN32
+        file = CreateFileA(temp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        failed = file == INVALID_HANDLE_VALUE;
+#else
+        fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed = fd < 0;
+#endif
+    }
+    SafeFileWriter(const SafeFileWriter &) = delete;
+    SafeFileWriter &operator=(const SafeFileWriter &) = delete;
+    ~SafeFileWriter()
+    {
+        if (!committed)
+        {
+            closeFile();
+            remove(temp.c_str());
+        }
+    }
+
+    bool ok() const { return !failed; }
+
+    void write(string_view text) { write(text.data(), text.size()); }
+
+    // числа форматируются to_chars: без локали, double - кратчайшее точное представление
+    template <class N>
+    void number(N value)
+    {
+        char digits[32];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        write(digits, result.ptr - digits);
+    }
+
+    void write(const char *data, size_t size)
+    {
+        if (buffer.size() + size > bufferSize)
+            writeOut();
+        if (size >= bufferSize) // крупные блоки пишутся напрямую, без копии в буфер
+            writeRaw(data, size);
+        else
+            buffer.append(data, size);
+    }
+
+    // сброс, синхронизация и переименование поверх цели; при false цель не тронута
+    bool commit()
+    {
+        writeOut();
+#ifdef _WIN32
+        if (!failed && !FlushFileBuffers(file))
+            failed = true;
+        closeFile();
+        if (!failed && !MoveFileExA(temp.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            failed = true;
+#else
+        if (!failed && fsync(fd) != 0)
+            failed = true;
+        closeFile();
+        if (!failed && rename(temp.c_str(), target.c_str()) != 0)
+            failed = true;
+        if (!failed)
+        {
+            // чтобы само переименование тоже пережило сбой
+            size_t slash = target.rfind('/');
+            string dir = slash == string::npos ? "." : target.substr(0, slash + 1);
+            int dirFd = ::open(dir.c_str(), O_RDONLY);
+            if (dirFd >= 0)
+            {
+                fsync(dirFd);
+                ::close(dirFd);
+            }
+        }
+#endif
+        committed = !failed;
+        return committed;
+    }
+};
+
+bool writeDataFile(const string &filename, const Registry<Pipe> &pipes, const Registry<CompressorStation> &stations)
+{
+    ScopedTimer timer(OP_SAVE);
+    SafeFileWriter file(filename);
+    if (!file.ok())
+        return false;
+    countMetric(MC_SCANNED, pipes.size() + stations.size());
+
+    file.write("PIPES ");
+    file.number(pipes.size());
+    file.write("\n");
+    for (const auto &p : pipes)
+    {
+        file.number(p.id);
+        file.write("|");
+        file.write(p.name);
+        file.write("|");
+        file.number(p.length);
+        file.write("|");
+        file.number(p.diameter);
+        file.write(p.underRepair ? "|1\n" : "|0\n");
+    }
+
+    file.write("STATIONS ");
+    file.number(stations.size());
+    file.write("\n");
+    for (const auto &s : stations)
+    {
+        file.number(s.id);
+        file.write("|");
+        file.write(s.name);
+        file.write("|");
+        file.number(s.totalWorkshops);
+        file.write("|");
+        file.number(s.workingWorkshops);
+        file.write("|");
+        file.number(s.stationClass);
+        file.write("\n");
+    }
+
+    return file.commit();
+}
+
+bool saveDataFile(const string &filename, const Registry<Pipe> &pipes, const Registry<CompressorStation> &stations)
+{
+    if (!writeDataFile(filename, pipes, stations))
+        return false;
+    if (g_journal.active() && filename == g_journal.snapshotName())
+        g_journal.reset(); // рабочий снимок переписан, журнал до него больше не нужен
+    g_logger.log("Saved to '" + filename + "' - pipes:" + to_string(pipes.size()) + ", stations:" + to_string(stations.size()));
+    g_events.record(EV_SAVED, 0, pipes.size() + stations.size());
+    return true;
+}
+
+void saveToFile(const Registry<Pipe> &pipes, const Registry<CompressorStation> &stations)
+{
+    string filename = readString("Enter filename to save: ");
+    if (filename.empty())
+        filename = "pipeline_data.txt";
+
+    if (!saveDataFile(filename, pipes, stations))
+    {
+        cout << "Error: cannot write file, '" << filename << "' left unchanged\n";
+        return;
+    }
+    cout << "Saved to '" << filename << "'\n";
+}
+// заменяет содержимое реестров данными файла; при ошибке реестры не меняются
+bool readDataFile(const string &filename, Registry<Pipe> &pipes, Registry<CompressorStation> &stations, string &error,
+                  size_t &skipped)
+{
+    ScopedTimer timer(OP_LOAD);
+    MappedFile mapped;
+    if (!mapped.open(filename))
+    {
+        error = "cannot open file";
+        return false;
+    }
+
+    // секции: строка "PIPES n", записи труб, строка "STATIONS m", записи станций;
+    // записи начинаются с ID, поэтому заголовок STATIONS однозначно находится поиском
+    string_view text(mapped.data(), mapped.size());
+    if (text.compare(0, 6, "PIPES ") != 0)
+    {
+        error = "not a pipeline data file";
+        return false;
+    }
+    size_t stationsAt = text.find("\nSTATIONS ");
+    if (stationsAt == string_view::npos)
+        stationsAt = text.size();
+    else
+        stationsAt++;
+    auto bodyOf = [](string_view section)
+    {
+        size_t eol = section.find('\n');
+        return eol == string_view::npos ? string_view() : section.substr(eol + 1);
+    };
+
+    size_t bad = 0;
+    auto pipeParts = parseSection<ParsedPipe>(bodyOf(text.substr(0, stationsAt)), bad);
+    auto stationParts = parseSection<ParsedStation>(bodyOf(text.substr(stationsAt)), bad);
+
+    // слияние последовательно: конструкторы резервируют ID в общем аллокаторе
+    vector<Pipe> loadedPipes;
+    vector<CompressorStation> loadedStations;
+    size_t pipeCount = 0, stationCount = 0;
+    for (const auto &part : pipeParts)
+        pipeCount += part.size();
+    for (const auto &part : stationParts)
+        stationCount += part.size();
+    countMetric(MC_SCANNED, pipeCount + stationCount + bad);
+    loadedPipes.reserve(pipeCount);
+    loadedStations.reserve(stationCount);
+    for (const auto &part : pipeParts)
+        for (const ParsedPipe &r : part)
+        {
+            Pipe p(r.id);
+            p.name.assign(r.name);
+            p.length = r.length;
+            p.diameter = r.diameter;
+            p.underRepair = r.repair != 0;
+            loadedPipes.push_back(move(p));
+        }
+    for (const auto &part : stationParts)
+        for (const ParsedStation &r : part)
+        {
+            CompressorStation s(r.id);
+            s.name.assign(r.name);
+            s.totalWorkshops = r.total;
+            s.workingWorkshops = r.working;
+            s.stationClass = r.cls;
+            loadedStations.push_back(move(s));
+        }
+    mapped.close();
+    skipped = bad;
+
+    Registry<Pipe> newPipes;
+    Registry<CompressorStation> newStations;
+    if (!newPipes.assign(move(loadedPipes)) || !newStations.assign(move(loadedStations)))
+    {
+        error = "file contains duplicate IDs";
+        return false;
+    }
+    pipes = move(newPipes);
+    stations = move(newStations);
+    return true;
+}
+
+// переписывает рабочий снимок текущим состоянием и начинает журнал заново
+void compactJournal(const Registry<Pipe> &pipes, const Registry<CompressorStation> &stations)
+{
+    g_journal.commit();
+    if (writeDataFile(g_journal.snapshotName(), pipes, stations) && g_journal.reset())
+        g_logger.log("Journal compacted into '" + g_journal.snapshotName() + "'");
+    else
+        cerr << "Warning: journal compaction failed, journal kept\n";
+}
+
+// восстановление при запуске: рабочий снимок, затем воспроизведение журнала
+void recoverFromJournal(const string &snapshotName, Registry<Pipe> &pipes, Registry<CompressorStation> &stations)
+{
+    ScopedTimer timer(OP_RECOVER);
+    string error;
+    size_t skipped = 0;
+    if (ifstream(snapshotName).good() && !readDataFile(snapshotName, pipes, stations, error, skipped))
+        cerr << "Warning: snapshot '" << snapshotName << "': " << error << "\n";
+
+    IdIndex doomed; // подряд идущие удаления применяются одним проходом
+    auto flushDeletes = [&]()
+    {
+        if (doomed.size())
+        {
+            pipes.eraseAll(doomed);
+            doomed.clear();
+        }
+    };
+    size_t applied = 0;
+    uint64_t valid = replayJournal(Journal::journalName(snapshotName), applied, [&](JournalOp op, JournalReader &in)
+    {
+        if (op != JR_PIPE_DELETE)
+            flushDeletes();
+        if (op == JR_RESET)
+        {
+            pipes = Registry<Pipe>();
+            stations = Registry<CompressorStation>();
+            return;
+        }
+        int id = in.get<int>();
+        if (op == JR_PIPE_PUT)
+        {
+            string name = in.getString();
+            double length = in.get<double>();
+            int diameter = in.get<int>();
+            bool repair = in.get<bool>();
+            if (!in.ok())
+                return;
+            Pipe *p = pipes.find(id);
+            if (!p)
+                p = pipes.get(pipes.add(Pipe(id)));
+            p->name = name;
+            p->length = length;
+            p->diameter = diameter;
+            p->underRepair = repair;
+        }
+        else if (op == JR_PIPE_DELETE)
+            doomed.put(id, 0);
+        else if (op == JR_PIPE_REPAIR)
+        {
+            bool repair = in.get<bool>();
+            if (Pipe *p = pipes.find(id))
+                if (in.ok())
+                    p->underRepair = repair;
+        }
+        else if (op == JR_STATION_PUT)
+        {
+            string name = in.getString();
+            int total = in.get<int>(), working = in.get<int>(), cls = in.get<int>();
+            if (!in.ok())
+                return;
+            CompressorStation *st = stations.find(id);
+            if (!st)
+                st = stations.get(stations.add(CompressorStation(id)));
+            st->name = name;
+            st->totalWorkshops = total;
+            st->workingWorkshops = working;
+            st->stationClass = cls;
+        }
+        else if (op == JR_STATION_WORKING)
+        {
+            int working = in.get<int>();
+            if (CompressorStation *st = stations.find(id))
+                if (in.ok())
+                    st->workingWorkshops = working;
+        }
+    });
+    flushDeletes();
+    countMetric(MC_SCANNED, applied);
+
+    if (!g_journal.open(snapshotName, valid))
+        cerr << "Warning: cannot open journal '" << Journal::journalName(snapshotName) << "'\n";
+    cerr << "Recovered " << pipes.size() << " pipes, " << stations.size() << " stations (" << applied << " journal record(s) replayed)\n";
+    g_logger.log("Recovered from '" + snapshotName + "' + journal: " + to_string(applied) + " record(s)");
+}
+
+bool loadDataFile(const string &filename, Registry<Pipe> &pipes, Registry<CompressorStation> &stations, NameIndex &pipeNames,
+                  NameIndex &stationNames, UtilisationIndex &utilisation, string &error, size_t &skipped)
+{
+    if (!readDataFile(filename, pipes, stations, error, skipped))
+        return false;
+    pipeNames.rebuild(pipes);
+    stationNames.rebuild(stations);
+    utilisation.rebuild(stations);
+    g_logger.log("Loaded from '" + filename + "' - pipes:" + to_string(pipes.size()) + ", stations:" + to_string(stations.size()));
+    g_events.record(EV_LOADED, 0, pipes.size() + stations.size());
+    // загрузка попадает в журнал как сброс и все новое состояние; рабочий снимок на диске
+    // не трогается, пока журнал не свернется обычным порядком
+    if (g_journal.active())
+    {
+        g_journal.append(JournalRecord(JR_RESET));
+        for (const auto &p : pipes)
+            journalPipe(p);
+        for (const auto &s : stations)
+            journalStation(s);
+    }
+    return true;
+}
+
+void loadFromFile(Registry<Pipe> &pipes, Registry<CompressorStation> &stations, NameIndex &pipeNames, NameIndex &stationNames,
+                  UtilisationIndex &utilisation)
+{
+    string filename = readString("Enter filename to load: ");
+    if (filename.empty())
+        filename = "pipeline_data.txt";
+
+    string error;
+    size_t skipped = 0;
+    if (!loadDataFile(filename, pipes, stations, pipeNames, stationNames, utilisation, error, skipped))
+    {
+        cout << "Error: " << error << "\n";
+        return;
+    }
+    if (skipped)
+        cout << "Skipped " << skipped << " malformed line(s)\n";
+    cout << "Loaded from '" << filename << "' - " << pipes.size() << " pipes, " << stations.size() << " stations\n";
+}
+
+void viewLog()
+{
+    g_logger.flush(); // журнал пишется фоновым потоком
+    ifstream file("pipeline_log.txt");
+    if (!file.is_open())
+    {
+        cout << "No log file\n";
+        return;
+    }
+    cout << "\n=== LOG ===\n";
+    string line;
+    while (getline(file, line))
+        cout << line << "\n";
+    file.close();
 }
 
-vector<Pipe *> searchPipesByName(vector<Pipe> &pipes, const string &name) // возвращаются указатели на элементы внутри исходного
+// "YYYY-MM-DD HH:MM:SS" в местном времени; пустая строка - без ограничения
+bool parseTime(const string &text, int64_t &out)
 {
-    vector<Pipe *> results;
-    for (auto &p : pipes)
-        if (p.name.find(name) != string::npos)
-            results.push_back(&p);
-    g_logger.log("Search pipes by name: '" + name + "' -> " + to_string(results.size()));
-    return results;
+    istringstream iss(text);
+    tm t = {};
+    iss >> get_time(&t, "%Y-%m-%d %H:%M:%S");
+    if (iss.fail())
+        return false;
+    t.tm_isdst = -1;
+    out = (int64_t)mktime(&t);
+    return true;
 }
 
-vector<Pipe *> searchPipesByRepair(vector<Pipe> &pipes, bool repair)
+// просмотр журнала событий: файлы отображаются в память, диапазон времени находится
+// двоичным поиском (записи идут по неубыванию времени), остальные фильтры проверяются только внутри него
+void viewEvents()
 {
-    vector<Pipe *> results;
-    for (auto &p : pipes)
-        if (p.underRepair == repair)
-            results.push_back(&p);
-    g_logger.log("Search pipes by repair: " + string(repair ? "yes" : "no") + " -> " + to_string(results.size()));
-    return results;
+    g_events.flush();
+    int64_t from = numeric_limits<int64_t>::min(), to = numeric_limits<int64_t>::max();
+    string text = readString("From (YYYY-MM-DD HH:MM:SS, empty = any): ");
+    if (!text.empty() && !parseTime(text, from))
+        cout << "Unrecognised time, ignoring\n";
+    cout << "To (YYYY-MM-DD HH:MM:SS, empty = any): ";
+    getline(cin, text);
+    if (!text.empty() && !parseTime(text, to))
+        cout << "Unrecognised time, ignoring\n";
+    int entity = readInt("Entity ID (0 = any): ", 0, numeric_limits<int>::max());
+    cout << "Events:";
+    for (int c = 1; c < EV_CODE_COUNT; c++)
+        cout << " " << c << "=" << eventNames[c];
+    int code = readInt("\nEvent (0 = any): ", 0, EV_CODE_COUNT - 1);
+
+    string base = g_events.filename().empty() ? "pipeline_events.bin" : g_events.filename();
+    int rotated = g_events.filename().empty() ? 3 : g_events.rotatedFiles();
+    size_t shown = 0;
+    bool anyFile = false;
+    cout << "\n=== EVENTS ===\n";
+    for (int generation = rotated; generation >= 0; generation--) // от старых файлов к текущему
+    {
+        MappedFile mapped;
+        if (!mapped.open(EventLog::rotatedName(base, generation)) || mapped.size() < sizeof(eventMagic) ||
+            memcmp(mapped.data(), eventMagic, sizeof(eventMagic)) != 0)
+            continue;
+        anyFile = true;
+        const EventRecord *first = (const EventRecord *)(mapped.data() + sizeof(eventMagic));
+        const EventRecord *last = first + (mapped.size() - sizeof(eventMagic)) / sizeof(EventRecord);
+        const EventRecord *lo = lower_bound(first, last, from, [](const EventRecord &r, int64_t t) { return r.time < t; });
+        const EventRecord *hi = upper_bound(lo, last, to, [](int64_t t, const EventRecord &r) { return t < r.time; });
+        for (const EventRecord *r = lo; r != hi; r++)
+        {
+            if ((entity && r->entityId != entity) || (code && r->code != code))
+                continue;
+            time_t t = (time_t)r->time;
+            char stamp[20];
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&t));
+            cout << "[" << stamp << "] " << (r->code < EV_CODE_COUNT ? eventNames[r->code] : "UNKNOWN");
+            if (r->entityId)
+                cout << " id=" << r->entityId;
+            cout << " count=" << r->count << "\n";
+            shown++;
+        }
+    }
+    if (!anyFile)
+        cout << "No event log (start with --event-log)\n";
+    else
+        cout << shown << " event(s)\n";
 }
 
-void deletePipesFromVector(vector<Pipe> &pipes, const vector<Pipe *> &toDelete)
+// ============ METRICS ============
+// таблица метрик операций для меню
+void displayMetrics()
 {
-    for (auto pipePtr : toDelete)
+    cout << "\n=== OPERATION METRICS ===\n";
+    cout << left << setw(10) << "Operation" << right << setw(8) << "Calls" << setw(12) << "p50, us" << setw(12)
+         << "p99, us" << setw(12) << "Max, us" << setw(14) << "Scanned" << setw(12) << "Allocs" << setw(14)
+         << "Bytes out" << "\n";
+    bool any = false;
+    cout << fixed << setprecision(1);
+    for (int op = 0; op < OP_COUNT; op++)
     {
-        pipes.erase(remove_if(pipes.begin(), pipes.end(),
-                              [pipePtr](const Pipe &p)
-                              { return p.id == pipePtr->id; }),
-                    pipes.end());
+        const OperationMetrics &m = g_metrics[op];
+        if (m.latency.count() == 0)
+            continue;
+        any = true;
+        cout << left << setw(10) << metricOpNames[op] << right << setw(8) << m.latency.count() << setw(12)
+             << m.latency.percentile(0.5) / 1e3 << setw(12) << m.latency.percentile(0.99) / 1e3 << setw(12)
+             << m.latency.maxNs() / 1e3;
+        for (int c = 0; c < MC_COUNT; c++)
+            cout << setw(c == MC_ALLOCATIONS ? 12 : 14) << m.counters[c].load(memory_order_relaxed);
+        cout << "\n";
     }
+    cout << defaultfloat << setprecision(6);
+    if (!any)
+        cout << "No operations timed yet\n";
 }
 
-void batchEditPipes(vector<Pipe> &pipes, vector<Pipe *> &results, int action)
+// текстовый формат Prometheus (например, для textfile collector у node exporter);
+// файл заменяется атомарно, поэтому сборщик никогда не прочитает его наполовину
+bool exportMetrics(const string &filename)
 {
-    if (results.empty())
+    ostringstream text;
+    text << setprecision(9);
+    text << "# HELP pipeline_operation_seconds Latency of task 2 operations.\n"
+         << "# TYPE pipeline_operation_seconds summary\n";
+    for (int op = 0; op < OP_COUNT; op++)
     {
-        cout << "No pipes found\n";
-        return;
+        const LatencyHistogram &h = g_metrics[op].latency;
+        string label = string("{op=\"") + metricOpNames[op] + "\"";
+        text << "pipeline_operation_seconds" << label << ",quantile=\"0.5\"} " << h.percentile(0.5) / 1e9 << "\n"
+             << "pipeline_operation_seconds" << label << ",quantile=\"0.99\"} " << h.percentile(0.99) / 1e9 << "\n"
+             << "pipeline_operation_seconds_sum" << label << "} " << h.sumNs() / 1e9 << "\n"
+             << "pipeline_operation_seconds_count" << label << "} " << h.count() << "\n";
     }
-
-    cout << "\nFound " << results.size() << " pipe(s):\n";
-    for (size_t i = 0; i < results.size(); i++)
+    text << "# HELP pipeline_operation_max_seconds Slowest call of each operation.\n"
+         << "# TYPE pipeline_operation_max_seconds gauge\n";
+    for (int op = 0; op < OP_COUNT; op++)
+        text << "pipeline_operation_max_seconds{op=\"" << metricOpNames[op] << "\"} "
+             << g_metrics[op].latency.maxNs() / 1e9 << "\n";
+    for (int c = 0; c < MC_COUNT; c++)
     {
-        cout << (i + 1) << ". ";
-        displayPipe(*results[i]);
+        text << "# TYPE pipeline_" << metricCounterNames[c] << "_total counter\n";
+        for (int op = 0; op < OP_COUNT; op++)
+            text << "pipeline_" << metricCounterNames[c] << "_total{op=\"" << metricOpNames[op] << "\"} "
+                 << g_metrics[op].counters[c].load(memory_order_relaxed) << "\n";
     }
+    SafeFileWriter out(filename);
+    out.write(text.str());
+    return out.commit();
+}
 
-    cout << "\n1=Edit all, 2=Select, 0=Cancel: ";
-    int choice;
-    cin >> choice;
+string g_metricsFile; // --metrics FILE; пустая строка - без выгрузки
+chrono::steady_clock::time_point g_metricsExported;
 
-    vector<Pipe *> selected;
-    if (choice == 1)
-        selected = results;
-    else if (choice == 2)
-    {
-        cout << "Enter numbers (1-" << results.size() << ") space-separated: ";
-        cin.ignore();
-        string input;
-        getline(cin, input);
-        istringstream iss(input);
-        int num;
-        while (iss >> num)
-            if (num > 0 && num <= (int)results.size())
-                selected.push_back(results[num - 1]);
-    }
-    else
+// выгружает не чаще раза в несколько секунд, чтобы частые операции оставались дешевыми
+void exportMetricsIfDue(bool force = false)
+{
+    if (g_metricsFile.empty())
+        return;
+    auto now = chrono::steady_clock::now();
+    if (!force && now - g_metricsExported < chrono::seconds(10))
         return;
+    g_metricsExported = now;
+    if (!exportMetrics(g_metricsFile))
+        cerr << "Warning: cannot write metrics to '" << g_metricsFile << "'\n";
+}
 
-    if (action == 1)
-    {
-        for (auto p : selected)
-            p->underRepair = !p->underRepair;
-        cout << "Repair status changed: " << selected.size() << " pipe(s)\n";
-        g_logger.log("Batch: toggled repair on " + to_string(selected.size()) + " pipe(s)");
-    }
-    else if (action == 2)
+// ============ HEADLESS MODE ============
+// Команды читаются по одной на строку, аргументы разделяются пробелами,
+// имена с пробелами берутся в кавычки ("Main line"), '#' - комментарий.
+// На каждую команду выводится одна строка JSON; вывод копится в буфере и
+// уходит блоками, перед каждым блоком журнал фиксируется одним fsync.
+bool splitCommand(const string &line, vector<string> &args)
+{
+    args.clear();
+    size_t i = 0;
+    while (i < line.size())
     {
-        cout << "Delete " << selected.size() << " pipe(s)? (y/n): ";
-        char c;
-        cin >> c;
-        if (c == 'y' || c == 'Y')
+        if (isspace((unsigned char)line[i]))
+        {
+            i++;
+            continue;
+        }
+        if (line[i] == '#')
+            break;
+        string arg;
+        if (line[i] == '"')
+        {
+            size_t close = line.find('"', i + 1);
+            if (close == string::npos)
+                return false;
+            arg = line.substr(i + 1, close - i - 1);
+            i = close + 1;
+        }
+        else
         {
-            deletePipesFromVector(pipes, selected);
-            cout << "Deleted: " << selected.size() << " pipe(s)\n";
-            g_logger.log("Batch: deleted " + to_string(selected.size()) + " pipe(s)");
+            while (i < line.size() && !isspace((unsigned char)line[i]))
+                arg += line[i++];
         }
+        args.push_back(arg);
     }
+    return true;
 }
 
-// ============ STATION OPERATIONS ============
-void addStation(vector<CompressorStation> &stations)
-{
-    CompressorStation st;
-    st.name = readString("Enter station name: ");
-    st.totalWorkshops = readPositiveInt("Enter total workshops: ");
-    st.workingWorkshops = readInt("Enter working workshops: ", 0, st.totalWorkshops);
-    st.stationClass = readPositiveInt("Enter station class: ");
-
-    stations.push_back(st);
-    cout << "Station added (ID: " << st.id << ")\n";
-    g_logger.log("Added station - ID: " + to_string(st.id) + ", Name: " + st.name);
-}
-
-void displayStation(const CompressorStation &st)
+class BatchOutput
 {
-    cout << "[ID:" << st.id << "] " << st.name
-         << " | " << st.workingWorkshops << "/" << st.totalWorkshops << " working"
-         << " | Unused: " << fixed << (int)st.getUnusedPercent() << "%"
-         << " | Class:" << st.stationClass << "\n";
-}
+    string buffer;
+    static const size_t flushSize = 1 << 16;
+    size_t lineStart = 0;
+    vector<size_t> changed;  // начала строк в буфере, чьи команды добавили записи в журнал
+    size_t pendingSeen = 0;  // объем незафиксированного журнала после предыдущей строки
+    size_t notDurable = 0;
 
-void displayAllStations(const vector<CompressorStation> &stations)
-{
-    if (stations.empty())
+    // журнал не удалось записать: успехи команд, изменивших данные, становятся ошибками
+    void markNotDurable()
     {
-        cout << "No stations\n";
-        return;
+        static const string ok = "\"ok\":true";
+        for (size_t i = changed.size(); i-- > 0;)
+        {
+            size_t at = buffer.find(ok, changed[i]);
+            if (at == string::npos || at >= buffer.find('\n', changed[i]))
+                continue;
+            buffer.replace(at, ok.size(), "\"ok\":false,\"durable\":false,\"error\":\"journal write failed\"");
+            notDurable++;
+        }
     }
-    cout << "\n=== STATIONS ===\n";
-    for (const auto &s : stations)
-        displayStation(s);
-}
 
-vector<CompressorStation *> searchStationsByName(vector<CompressorStation> &stations, const string &name)
-{
-    vector<CompressorStation *> results;
-    for (auto &s : stations)
-        if (s.name.find(name) != string::npos)
-            results.push_back(&s);
-    g_logger.log("Search stations by name: '" + name + "' -> " + to_string(results.size()));
-    return results;
-}
+public:
+    ~BatchOutput() { flush(); }
 
-vector<CompressorStation *> searchStationsByUnused(vector<CompressorStation> &stations, double minPercent)
-{
-    vector<CompressorStation *> results;
-    for (auto &s : stations)
-        if (s.getUnusedPercent() >= minPercent)
-            results.push_back(&s);
-    g_logger.log("Search stations by unused >= " + to_string((int)minPercent) + "% -> " + to_string(results.size()));
-    return results;
-}
+    void write(string_view text) { buffer.append(text.data(), text.size()); }
 
-void editStation(CompressorStation &st)
-{
-    cout << "1=Start workshop, 2=Stop workshop, 0=Back: ";
-    int choice;
-    cin >> choice;
-    if (choice == 1)
+    template <class N>
+    void number(N value)
     {
-        st.adjustWorkshops(1); // запуск или остановка цеха
-        cout << "Working: " << st.workingWorkshops << "/" << st.totalWorkshops << "\n";
-        g_logger.log("Station " + to_string(st.id) + ": started workshop");
+        char digits[32];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        buffer.append(digits, result.ptr - digits);
     }
-    else if (choice == 2)
+
+    void quoted(string_view text)
     {
-        st.adjustWorkshops(-1);
-        cout << "Working: " << st.workingWorkshops << "/" << st.totalWorkshops << "\n";
-        g_logger.log("Station " + to_string(st.id) + ": stopped workshop");
+        buffer += '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                buffer += '\\';
+                buffer += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                buffer += escaped;
+            }
+            else
+                buffer += c;
+        }
+        buffer += '"';
     }
-}
 
-// ============ FILE I/O ============
-void saveToFile(const vector<Pipe> &pipes, const vector<CompressorStation> &stations)
-{
-    string filename = readString("Enter filename to save: ");
-    if (filename.empty())
-        filename = "pipeline_data.txt";
+    // число результатов, выданных ошибками из-за сбоя журнала
+    size_t failures() const { return notDurable; }
 
-    ofstream file(filename);
-    if (!file.is_open())
+    void begin(size_t line, const string &command)
     {
-        cout << "Error: cannot open file\n";
-        return;
+        lineStart = buffer.size();
+        write("{\"line\":");
+        number(line);
+        write(",\"cmd\":");
+        quoted(command);
     }
 
-    file << "PIPES " << pipes.size() << "\n";
-    for (const auto &p : pipes)
-        file << p.id << "|" << p.name << "|" << p.length << "|" << p.diameter << "|" << p.underRepair << "\n";
-
-    file << "STATIONS " << stations.size() << "\n";
-    for (const auto &s : stations)
-        file << s.id << "|" << s.name << "|" << s.totalWorkshops << "|" << s.workingWorkshops << "|" << s.stationClass << "\n";
-
-    file.close();
-    cout << "Saved to '" << filename << "'\n";
-    g_logger.log("Saved to '" + filename + "' - pipes:" + to_string(pipes.size()) + ", stations:" + to_string(stations.size()));
-}
-
-void loadFromFile(vector<Pipe> &pipes, vector<CompressorStation> &stations)
-{
-    string filename = readString("Enter filename to load: ");
-    if (filename.empty())
-        filename = "pipeline_data.txt";
-
-    ifstream file(filename);
-    if (!file.is_open())
+    void end()
     {
-        cout << "Error: cannot open file\n";
-        return;
+        write("}\n");
+        if (g_journal.pendingSize() != pendingSeen)
+            changed.push_back(lineStart);
+        pendingSeen = g_journal.pendingSize();
+        if (buffer.size() >= flushSize)
+            flush();
     }
 
-    pipes.clear();
-    stations.clear();
+    void error(size_t line, const string &command, const string &message)
+    {
+        begin(line, command);
+        write(",\"ok\":false,\"error\":");
+        quoted(message);
+        end();
+    }
 
-    string line, section;
-    while (getline(file, line))
+    // результат уходит наружу только после того, как изменения, о которых он сообщает, записаны
+    void flush()
     {
-        if (line.empty())
-            continue;
-        istringstream iss(line);
-        string word;
-        iss >> word;
-
-        if (word == "PIPES")
-            section = "PIPES";
-        else if (word == "STATIONS")
-            section = "STATIONS";
-        else if (section == "PIPES")
-        {
-            int id, diameter;
-            string name;
-            double length;
-            bool repair;
-            char delim;
-            istringstream iss(line);
-            iss >> id >> delim >> name >> delim >> length >> delim >> diameter >> delim >> repair;
-            Pipe p;
-            p.id = id;
-            p.name = name;
-            p.length = length;
-            p.diameter = diameter;
-            p.underRepair = repair;
-            pipes.push_back(p);
-        }
-        else if (section == "STATIONS")
-        {
-            int id, total, working, cls;
-            string name;
-            char delim;
-            istringstream iss(line);
-            iss >> id >> delim >> name >> delim >> total >> delim >> working >> delim >> cls;
-            CompressorStation s;
-            s.id = id;
-            s.name = name;
-            s.totalWorkshops = total;
-            s.workingWorkshops = working;
-            s.stationClass = cls;
-            stations.push_back(s);
+        if (!g_journal.commit())
+        {
+            cerr << "Error: journal write failed\n";
+            markNotDurable();
         }
+        changed.clear();
+        pendingSeen = g_journal.pendingSize();
+        if (buffer.empty())
+            return;
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+        fflush(stdout);
+        buffer.clear();
     }
+};
 
-    file.close();
-    cout << "Loaded from '" << filename << "' - " << pipes.size() << " pipes, " << stations.size() << " stations\n";
-    g_logger.log("Loaded from '" + filename + "' - pipes:" + to_string(pipes.size()) + ", stations:" + to_string(stations.size()));
+void writePipes(BatchOutput &out, const Registry<Pipe> &pipes, const vector<Handle> &found)
+{
+    out.write(",\"count\":");
+    out.number(found.size());
+    out.write(",\"pipes\":[");
+    bool first = true;
+    for (Handle h : found)
+        if (const Pipe *p = pipes.get(h))
+        {
+            out.write(first ? "{\"id\":" : ",{\"id\":");
+            first = false;
+            out.number(p->id);
+            out.write(",\"name\":");
+            out.quoted(p->name);
+            out.write(",\"length\":");
+            out.number(p->length);
+            out.write(",\"diameter\":");
+            out.number(p->diameter);
+            out.write(p->underRepair ? ",\"repair\":true}" : ",\"repair\":false}");
+        }
+    out.write("]");
 }
 
-void viewLog()
+void writeStations(BatchOutput &out, const Registry<CompressorStation> &stations, const vector<Handle> &found)
 {
-    ifstream file("pipeline_log.txt");
-    if (!file.is_open())
+    out.write(",\"count\":");
+    out.number(found.size());
+    out.write(",\"stations\":[");
+    bool first = true;
+    for (Handle h : found)
+        if (const CompressorStation *s = stations.get(h))
+        {
+            out.write(first ? "{\"id\":" : ",{\"id\":");
+            first = false;
+            out.number(s->id);
+            out.write(",\"name\":");
+            out.quoted(s->name);
+            out.write(",\"total\":");
+            out.number(s->totalWorkshops);
+            out.write(",\"working\":");
+            out.number(s->workingWorkshops);
+            out.write(",\"class\":");
+            out.number(s->stationClass);
+            out.write("}");
+        }
+    out.write("]");
+}
+
+// выполняет скрипт команд; возвращает число команд, завершившихся ошибкой
+size_t runBatch(istream &script, Registry<Pipe> &pipes, Registry<CompressorStation> &stations, NameIndex &pipeNames,
+                NameIndex &stationNames, UtilisationIndex &utilisation)
+{
+    BatchOutput out;
+    string line;
+    vector<string> args;
+    size_t lineNo = 0, failed = 0;
+    g_logger.log("Batch mode started");
+
+    while (getline(script, line))
     {
-        cout << "No log file\n";
-        return;
+        lineNo++;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!splitCommand(line, args))
+        {
+            out.error(lineNo, "", "unterminated quote");
+            failed++;
+            continue;
+        }
+        if (args.empty())
+            continue;
+        const string &cmd = args[0];
+        string what = args.size() > 1 ? args[1] : "";
+        string error;
+
+        if (cmd == "add" && what == "pipe" && args.size() == 5)
+        {
+            Pipe pipe;
+            pipe.name = args[2];
+            if (!parseField(args[3], pipe.length) || pipe.length <= 0 || !parseField(args[4], pipe.diameter) || pipe.diameter <= 0)
+                error = "expected: add pipe NAME LENGTH DIAMETER";
+            else
+            {
+                storePipe(pipes, pipeNames, pipe);
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true,\"id\":");
+                out.number(pipe.id);
+                out.end();
+            }
+        }
+        else if (cmd == "add" && what == "station" && args.size() == 6)
+        {
+            CompressorStation st;
+            st.name = args[2];
+            if (!parseField(args[3], st.totalWorkshops) || st.totalWorkshops <= 0 || !parseField(args[4], st.workingWorkshops) ||
+                st.workingWorkshops < 0 || st.workingWorkshops > st.totalWorkshops || !parseField(args[5], st.stationClass) ||
+                st.stationClass <= 0)
+                error = "expected: add station NAME TOTAL WORKING CLASS";
+            else
+            {
+                storeStation(stations, stationNames, utilisation, st);
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true,\"id\":");
+                out.number(st.id);
+                out.end();
+            }
+        }
+        else if (cmd == "add")
+            error = "expected: add pipe|station ...";
+        else if (cmd == "list" && what == "pipes" && args.size() == 2)
+        {
+            vector<Handle> all;
+            for (const auto &p : pipes)
+                all.push_back(pipes.handleOf(p.id));
+            out.begin(lineNo, cmd);
+            out.write(",\"ok\":true");
+            writePipes(out, pipes, all);
+            out.end();
+        }
+        else if (cmd == "list" && what == "stations" && args.size() == 2)
+        {
+            vector<Handle> all;
+            for (const auto &s : stations)
+                all.push_back(stations.handleOf(s.id));
+            out.begin(lineNo, cmd);
+            out.write(",\"ok\":true");
+            writeStations(out, stations, all);
+            out.end();
+        }
+        else if (cmd == "list")
+            error = "expected: list pipes|stations";
+        else if (cmd == "search" && args.size() == 4)
+        {
+            const string &by = args[2];
+            double pct = 0;
+            int repair = 0;
+            if (what == "pipes" && by == "name")
+            {
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true");
+                writePipes(out, pipes, searchPipesByName(pipes, pipeNames, args[3]));
+                out.end();
+            }
+            else if (what == "pipes" && by == "repair" && parseField(args[3], repair) && (repair == 0 || repair == 1))
+            {
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true");
+                writePipes(out, pipes, searchPipesByRepair(pipes, repair == 1));
+                out.end();
+            }
+            else if (what == "stations" && by == "name")
+            {
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true");
+                writeStations(out, stations, searchStationsByName(stations, stationNames, args[3]));
+                out.end();
+            }
+            else if (what == "stations" && by == "unused" && parseField(args[3], pct) && pct >= 0)
+            {
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true");
+                writeStations(out, stations, searchStationsByUnused(stations, utilisation, pct));
+                out.end();
+            }
+            else
+                error = "expected: search pipes name|repair VALUE or search stations name|unused VALUE";
+        }
+        else if (cmd == "search")
+            error = "expected: search pipes|stations FIELD VALUE";
+        else if (cmd == "least" && (args.size() == 2 || args.size() == 3))
+        {
+            int k = 0, cls = 0;
+            if (!parseField(args[1], k) || k <= 0 || (args.size() == 3 && !parseField(args[2], cls)))
+                error = "expected: least K [CLASS]";
+            else
+            {
+                auto r = utilisation.leastUtilised(stations, k, cls);
+                g_logger.log("Least utilised stations, class " + to_string(cls) + " -> " + to_string(r.size()));
+                g_events.record(EV_STATION_SEARCH, 0, r.size());
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true");
+                writeStations(out, stations, r);
+                out.end();
+            }
+        }
+        else if (cmd == "least")
+            error = "expected: least K [CLASS]";
+        else if ((cmd == "repair" || cmd == "delete") && args.size() > 1)
+        {
+            vector<Handle> selected;
+            for (size_t i = 1; i < args.size() && error.empty(); i++)
+            {
+                int id = 0;
+                if (!parseField(args[i], id))
+                    error = "bad pipe ID '" + args[i] + "'";
+                else if (pipes.contains(id))
+                    selected.push_back(pipes.handleOf(id));
+            }
+            if (error.empty())
+            {
+                size_t changed = cmd == "repair" ? togglePipesRepair(pipes, selected) : deletePipesFromVector(pipes, pipeNames, selected);
+                if (cmd == "delete")
+                    g_logger.log("Batch: deleted " + to_string(changed) + " pipe(s)");
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true,\"count\":");
+                out.number(changed);
+                out.end();
+            }
+        }
+        else if (cmd == "repair" || cmd == "delete")
+            error = "expected: " + cmd + " ID...";
+        else if ((cmd == "start" || cmd == "stop") && args.size() == 2)
+        {
+            int id = 0;
+            CompressorStation *s = parseField(args[1], id) ? stations.find(id) : nullptr;
+            if (!s)
+                error = "station not found";
+            else if (cmd == "start" ? s->workingWorkshops >= s->totalWorkshops : s->workingWorkshops <= 0)
+                error = cmd == "start" ? "all workshops already working" : "no working workshops";
+            else
+            {
+                changeWorkshops(*s, utilisation, cmd == "start" ? 1 : -1);
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true,\"id\":");
+                out.number(s->id);
+                out.write(",\"working\":");
+                out.number(s->workingWorkshops);
+                out.end();
+            }
+        }
+        else if (cmd == "start" || cmd == "stop")
+            error = "expected: " + cmd + " STATION_ID";
+        else if ((cmd == "save" || cmd == "load") && args.size() <= 2)
+        {
+            string filename = args.size() == 2 ? args[1] : "pipeline_data.txt";
+            size_t skipped = 0;
+            bool done = cmd == "save" ? saveDataFile(filename, pipes, stations)
+                                      : loadDataFile(filename, pipes, stations, pipeNames, stationNames, utilisation, error, skipped);
+            if (!done && error.empty())
+                error = "cannot write file, '" + filename + "' left unchanged";
+            if (done)
+            {
+                out.begin(lineNo, cmd);
+                out.write(",\"ok\":true,\"file\":");
+                out.quoted(filename);
+                out.write(",\"pipes\":");
+                out.number(pipes.size());
+                out.write(",\"stations\":");
+                out.number(stations.size());
+                if (cmd == "load")
+                {
+                    out.write(",\"skipped\":");
+                    out.number(skipped);
+                }
+                out.end();
+            }
+        }
+        else if (cmd == "save" || cmd == "load")
+            error = "expected: " + cmd + " [FILE]";
+        else if (cmd == "metrics" && args.size() == 1)
+        {
+            // одна строка на все операции, замеренные к этому моменту; задержки в нс
+            out.begin(lineNo, cmd);
+            out.write(",\"ok\":true,\"operations\":{");
+            bool first = true;
+            for (int op = 0; op < OP_COUNT; op++)
+            {
+                const OperationMetrics &m = g_metrics[op];
+                if (m.latency.count() == 0)
+                    continue;
+                out.write(first ? "\"" : ",\"");
+                first = false;
+                out.write(metricOpNames[op]);
+                out.write("\":{\"count\":");
+                out.number(m.latency.count());
+                out.write(",\"p50_ns\":");
+                out.number(m.latency.percentile(0.5));
+                out.write(",\"p99_ns\":");
+                out.number(m.latency.percentile(0.99));
+                out.write(",\"max_ns\":");
+                out.number(m.latency.maxNs());
+                for (int c = 0; c < MC_COUNT; c++)
+                {
+                    out.write(",\"");
+                    out.write(metricCounterNames[c]);
+                    out.write("\":");
+                    out.number(m.counters[c].load(memory_order_relaxed));
+                }
+                out.write("}");
+            }
+            out.write("}");
+            out.end();
+        }
+        else
+            error = "unknown command";
+
+        if (!error.empty())
+        {
+            out.error(lineNo, cmd, error);
+            failed++;
+        }
+        if (g_journal.size() > journalCompactBytes)
+        {
+            out.flush(); // сначала фиксация, потом перезапись журнала
+            compactJournal(pipes, stations);
+        }
     }
-    cout << "\n=== LOG ===\n";
-    string line;
-    while (getline(file, line))
-        cout << line << "\n";
-    file.close();
+
+    out.flush();
+    failed += out.failures();
+    exportMetricsIfDue(true);
+    g_logger.log("Batch mode finished - " + to_string(lineNo) + " line(s), " + to_string(failed) + " failed");
+    return failed;
 }
 
 // ============ MENU ============
@@ -448,19 +2861,64 @@ void showMenu()
 {
     cout << "\n=== PIPELINE MANAGEMENT ===\n";
     cout << "PIPES: 1=Add, 2=View, 3=Search by name, 4=Search by repair, 5=Edit pipes\n";
-    cout << "STATIONS: 6=Add, 7=View, 8=Search by name, 9=Search by unused, 10=Edit station\n";
-    cout << "FILES: 11=Save, 12=Load, 13=View log\n";
+    cout << "STATIONS: 6=Add, 7=View, 8=Search by name, 9=Search by unused, 10=Edit station, 14=Least utilised\n";
+    cout << "FILES: 11=Save, 12=Load, 13=View log, 15=View events, 16=Operation metrics\n";
     cout << "0=Exit\nChoice: ";
 }
 
 // ============ MAIN ============
-int main()
+// PIPELINE_NO_MAIN: исходник подключается в бенчмарк (bench_second_task.cpp) без собственного main
+#ifndef PIPELINE_NO_MAIN
+int main(int argc, char *argv[])
 {
-    vector<Pipe> pipes;
-    vector<CompressorStation> stations;
+    Registry<Pipe> pipes;
+    Registry<CompressorStation> stations;
+    NameIndex pipeNames, stationNames;
+    UtilisationIndex utilisation;
+    string batchScript; // --batch FILE или --batch - (stdin)
     int choice;
 
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--event-log")
+        {
+            if (!g_events.enable())
+                cerr << "Error: '" << g_events.filename()
+                     << "' is not an event log or cannot be opened, events are not recorded\n";
+        }
+        else if (arg == "--journal")
+        {
+            recoverFromJournal("pipeline_data.txt", pipes, stations);
+            pipeNames.rebuild(pipes);
+            stationNames.rebuild(stations);
+            utilisation.rebuild(stations);
+        }
+        else if (arg == "--batch")
+            batchScript = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0 ? argv[++i] : "-";
+        else if (arg == "--metrics" && i + 1 < argc)
+            g_metricsFile = argv[++i];
+    }
     g_logger.log("=== Program started ===");
+    g_events.record(EV_PROGRAM_STARTED);
+
+    if (!batchScript.empty())
+    {
+        ifstream file;
+        if (batchScript != "-")
+        {
+            file.open(batchScript);
+            if (!file.is_open())
+            {
+                cerr << "Error: cannot open script '" << batchScript << "'\n";
+                return 2;
+            }
+        }
+        size_t failed = runBatch(batchScript == "-" ? cin : file, pipes, stations, pipeNames, stationNames, utilisation);
+        g_logger.log("=== Program exited ===");
+        g_events.record(EV_PROGRAM_EXITED);
+        return failed ? 1 : 0;
+    }
 
     while (true)
     {
@@ -470,7 +2928,7 @@ int main()
         switch (choice)
         {
         case 1:
-            addPipe(pipes);
+            addPipe(pipes, pipeNames);
             break;
         case 2:
             displayAllPipes(pipes);
@@ -478,12 +2936,12 @@ int main()
         case 3:
         {
             string name = readString("Search pipe name: ");
-            auto r = searchPipesByName(pipes, name);
+            auto r = searchPipesByName(pipes, pipeNames, name);
             if (!r.empty())
             {
                 cout << "\nFound:\n";
-                for (auto p : r)
-                    displayPipe(*p);
+                for (Handle h : r)
+                    displayPipe(*pipes.get(h));
             }
             else
                 cout << "Not found\n";
@@ -498,8 +2956,8 @@ int main()
             if (!r.empty())
             {
                 cout << "\nFound:\n";
-                for (auto p : r)
-                    displayPipe(*p);
+                for (Handle h : r)
+                    displayPipe(*pipes.get(h));
             }
             else
                 cout << "Not found\n";
@@ -508,20 +2966,20 @@ int main()
         case 5:
         {
             string name = readString("Search pipe name: ");
-            auto r = searchPipesByName(pipes, name);
+            auto r = searchPipesByName(pipes, pipeNames, name);
             if (!r.empty())
             {
                 cout << "1=Toggle repair, 2=Delete: ";
                 int act;
                 cin >> act;
-                batchEditPipes(pipes, r, act);
+                batchEditPipes(pipes, pipeNames, r, act);
             }
             else
                 cout << "Not found\n";
             break;
         }
         case 6:
-            addStation(stations);
+            addStation(stations, stationNames, utilisation);
             break;
         case 7:
             displayAllStations(stations);
@@ -529,12 +2987,12 @@ int main()
         case 8:
         {
             string name = readString("Search station name: ");
-            auto r = searchStationsByName(stations, name);
+            auto r = searchStationsByName(stations, stationNames, name);
             if (!r.empty())
             {
                 cout << "\nFound:\n";
-                for (auto s : r)
-                    displayStation(*s);
+                for (Handle h : r)
+                    displayStation(*stations.get(h));
             }
             else
                 cout << "Not found\n";
@@ -543,12 +3001,12 @@ int main()
         case 9:
         {
             double pct = readPositiveDouble("Min unused %: ");
-            auto r = searchStationsByUnused(stations, pct);
+            auto r = searchStationsByUnused(stations, utilisation, pct);
             if (!r.empty())
             {
                 cout << "\nFound:\n";
-                for (auto s : r)
-                    displayStation(*s);
+                for (Handle h : r)
+                    displayStation(*stations.get(h));
             }
             else
                 cout << "Not found\n";
@@ -562,12 +3020,10 @@ int main()
                 cout << "Enter station ID: ";
                 int id;
                 cin >> id;
-                for (auto &s : stations)
-                    if (s.id == id)
-                    {
-                        editStation(s);
-                        break;
-                    }
+                if (CompressorStation *s = stations.find(id))
+                    editStation(*s, utilisation);
+                else
+                    cout << "Station not found\n";
             }
             break;
         }
@@ -575,19 +3031,55 @@ int main()
             saveToFile(pipes, stations);
             break;
         case 12:
-            loadFromFile(pipes, stations);
+            loadFromFile(pipes, stations, pipeNames, stationNames, utilisation);
             break;
         case 13:
             viewLog();
             break;
+        case 14:
+        {
+            int k = readPositiveInt("How many stations: ");
+            cout << "Station class (0=Any): ";
+            int cls;
+            cin >> cls;
+            auto r = utilisation.leastUtilised(stations, k, cls);
+            g_logger.log("Least utilised stations, class " + to_string(cls) + " -> " + to_string(r.size()));
+            g_events.record(EV_STATION_SEARCH, 0, r.size());
+            if (!r.empty())
+            {
+                cout << "\nFound:\n";
+                for (Handle h : r)
+                    displayStation(*stations.get(h));
+            }
+            else
+                cout << "Not found\n";
+            break;
+        }
+        case 15:
+            viewEvents();
+            break;
+        case 16:
+            displayMetrics();
+            exportMetricsIfDue(true);
+            break;
         case 0:
+            exportMetricsIfDue(true);
             g_logger.log("=== Program exited ===");
+            g_events.record(EV_PROGRAM_EXITED);
             return 0;
         default:
             cout << "Invalid\n";
         }
+
+        // групповая фиксация: все изменения одной операции - один fsync
+        if (!g_journal.commit())
+            cout << "Warning: journal write failed\n";
+        if (g_journal.size() > journalCompactBytes)
+            compactJournal(pipes, stations);
+        exportMetricsIfDue();
     }
     return 0;
 }
+#endif
 // g++ second_task.cpp -o second_task.exe
 // second_task.exe